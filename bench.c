@@ -0,0 +1,487 @@
+// microbenchmarks for the memory allocator (or any other malloc() preloaded in front of it)
+#define _GNU_SOURCE			// for MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>			// for fork() and pipe(), every run gets a fresh process
+#include <sched.h>			// for sched_yield() while waiting on a full or empty ring
+#include <getopt.h>			// for parsing the command line options
+#include <pthread.h>		// for the worker threads and the barrier that starts them together
+#include <stdatomic.h>		// for the producer/consumer rings
+#include <time.h>			// for clock_gettime() to time the runs and single calls
+#include <sys/mman.h>		// for mmap(), the benchmark's own bookkeeping stays out of the allocator under test
+#include <sys/resource.h>	// for getrusage() to read the peak RSS
+#include <sys/wait.h>		// for waitpid() on the run's process
+
+/*
+   How to read the numbers. Every workload runs once per thread count, in a
+   process of its own, so the peak RSS belongs to that run alone. An "op" is
+   one call into the allocator (malloc, free, realloc or calloc). ops/sec is
+   the total over all threads divided by the wall time of the run, and every
+   SAMPLE_EVERY-th op is timed on its own for the p50/p99 latencies.
+   To compare with glibc run the same binary with and without
+   LD_PRELOAD=./mem_allocator.so.
+ */
+
+// ops per thread unless -n says otherwise
+#define DEFAULT_OPS 1000000
+// one op out of this many gets timed
+#define SAMPLE_EVERY 16
+// live blocks each thread keeps around in the random, larson and calloc workloads
+#define WINDOW 1024
+// blocks in flight between a producer and its consumer
+#define RING_SIZE 1024
+// times the larson workload makes its threads swap their blocks
+#define LARSON_ROUNDS 16
+// the realloc workload grows a buffer up to this size before starting over
+#define REALLOC_MAX (256 * 1024)
+
+// what one thread of a run works with
+struct worker {
+	int id;
+	long ops;							// ops this thread has to do
+	unsigned long long rng;				// state of its random number generator
+	unsigned *samples;					// timed ops in nanoseconds
+	long num_samples;
+	long counter;						// ops done, picks which ones get timed
+	unsigned long long start, end;		// when the thread started and finished its ops
+	struct run *run;
+};
+
+// a single-producer single-consumer ring, the producer is thread i and the consumer thread i+1
+struct ring {
+	_Atomic long head __attribute__((aligned(64)));		// next slot the consumer reads
+	_Atomic long tail __attribute__((aligned(64)));		// next slot the producer writes
+	void *slots[RING_SIZE];
+};
+
+// one run of one workload at one thread count
+struct run {
+	int threads;
+	long ops;
+	pthread_barrier_t barrier;
+	struct worker *workers;
+	struct ring *rings;					// producer/consumer only
+	void ***windows;					// larson only: every thread's live blocks
+	atomic_int producers_left;			// producer/consumer only
+};
+
+// what a run sends back to the parent through a pipe
+struct result {
+	double seconds;
+	long total_ops;
+	unsigned p50, p99;					// nanoseconds
+	long max_rss;						// KB
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64, good enough to pick sizes and slots
+static unsigned long long next_random(struct worker *w)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return w->rng;
+}
+
+// a size between 16 and max, with small sizes a lot more likely than large ones (like in real programs)
+static size_t random_size(struct worker *w, size_t max)
+{
+	unsigned long long r = next_random(w);
+	size_t limit = 16 << (r % 16);
+
+	if (limit > max)
+		limit = max;
+	return 16 + (r >> 8) % (limit - 15);
+}
+
+// memory for the bookkeeping, straight from the OS so it does not disturb the allocator being measured
+static void *map_zeroed(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		perror("bench: mmap");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+// runs one allocator call, timing it if it is a sampled one
+#define OP(w, call) do { \
+	if ((w)->counter++ % SAMPLE_EVERY == 0) { \
+		unsigned long long start_ = now_ns(); \
+		call; \
+		(w)->samples[(w)->num_samples++] = now_ns() - start_; \
+	} else { \
+		call; \
+	} \
+} while (0)
+
+// touches a fresh block, so the allocator cannot get away with handing out memory nobody writes to
+static void touch(void *p)
+{
+	if (!p) {
+		fprintf(stderr, "bench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	*(volatile char*)p = 1;
+}
+
+// fixed: malloc(64) and free() it right away, the thread cache fast path
+static void run_fixed(struct worker *w)
+{
+	void *p;
+	long i;
+
+	for (i = 0; i < w->ops; i += 2) {
+		OP(w, p = malloc(64));
+		touch(p);
+		OP(w, free(p));
+	}
+}
+
+// random: replace a random block out of WINDOW live ones with one of a random size
+static void run_random(struct worker *w)
+{
+	void **window = map_zeroed(WINDOW * sizeof(void*));
+	void *p;
+	long i;
+	int slot;
+
+	for (i = 0; i < w->ops; i++) {
+		slot = next_random(w) % WINDOW;
+		if (window[slot]) {
+			OP(w, free(window[slot]));
+			window[slot] = NULL;
+		} else {
+			OP(w, p = malloc(random_size(w, 8192)));
+			touch(p);
+			window[slot] = p;
+		}
+	}
+	for (slot = 0; slot < WINDOW; slot++)
+		free(window[slot]);
+	munmap(window, WINDOW * sizeof(void*));
+}
+
+// the consumer side: frees everything that is in the ring, returns the number of blocks freed
+static long drain_ring(struct worker *w, struct ring *ring)
+{
+	long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	long n = tail - head;
+
+	for (; head < tail; head++)
+		OP(w, free(ring->slots[head % RING_SIZE]));
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+	return n;
+}
+
+// producer/consumer: every thread mallocs blocks for the next thread to free, so all frees are cross-thread
+// (with a single thread it ends up freeing its own blocks)
+static void run_prodcons(struct worker *w)
+{
+	struct run *run = w->run;
+	struct ring *out = &run->rings[w->id];
+	struct ring *in = &run->rings[(w->id + run->threads - 1) % run->threads];
+	long produced, tail;
+	int pushed;
+	void *p;
+
+	for (produced = 0; produced < w->ops / 2; ) {
+		tail = atomic_load_explicit(&out->tail, memory_order_relaxed);
+		pushed = tail - atomic_load_explicit(&out->head, memory_order_acquire) < RING_SIZE;
+		if (pushed) {
+			OP(w, p = malloc(random_size(w, 1024)));
+			touch(p);
+			out->slots[tail % RING_SIZE] = p;
+			atomic_store_explicit(&out->tail, tail + 1, memory_order_release);
+			produced++;
+		}
+		// both rings are stuck on other threads, let them run (matters when there are more threads than CPUs)
+		if (!drain_ring(w, in) && !pushed)
+			sched_yield();
+	}
+	atomic_fetch_sub(&run->producers_left, 1);
+	// keep freeing until the thread feeding us is done and its last blocks are gone
+	while (atomic_load(&run->producers_left) > 0 || drain_ring(w, in) > 0)
+		if (!drain_ring(w, in))
+			sched_yield();
+}
+
+// larson: threads churn a set of live blocks, and after every round each one takes over
+// the set of its neighbour, so blocks keep getting freed by threads that did not allocate them
+static void run_larson(struct worker *w)
+{
+	struct run *run = w->run;
+	void **window;
+	void *p;
+	long i, per_round = w->ops / LARSON_ROUNDS;
+	int round, slot;
+
+	window = run->windows[w->id];
+	for (slot = 0; slot < WINDOW; slot++) {
+		window[slot] = malloc(random_size(w, 512));
+		touch(window[slot]);
+	}
+	for (round = 0; round < LARSON_ROUNDS; round++) {
+		pthread_barrier_wait(&run->barrier);
+		window = run->windows[(w->id + round) % run->threads];
+		for (i = 0; i < per_round; i += 2) {
+			slot = next_random(w) % WINDOW;
+			OP(w, free(window[slot]));
+			OP(w, p = malloc(random_size(w, 512)));
+			touch(p);
+			window[slot] = p;
+		}
+	}
+	pthread_barrier_wait(&run->barrier);
+	window = run->windows[w->id];
+	for (slot = 0; slot < WINDOW; slot++)
+		free(window[slot]);
+}
+
+// realloc: grow a buffer by half its size at a time, like a vector or a string builder would
+static void run_realloc(struct worker *w)
+{
+	char *buf = NULL, *p;
+	size_t size = 0;
+	long i;
+
+	for (i = 0; i < w->ops; i++) {
+		size = size < 16 ? 16 : size + size / 2;
+		if (size > REALLOC_MAX) {
+			OP(w, free(buf));
+			buf = NULL;
+			size = 0;
+			continue;
+		}
+		OP(w, p = realloc(buf, size));
+		touch(p);
+		p[size - 1] = 1;
+		buf = p;
+	}
+	free(buf);
+}
+
+// calloc: replace a random block out of WINDOW live ones with a zeroed one, some of them big
+static void run_calloc(struct worker *w)
+{
+	void **window = map_zeroed(WINDOW * sizeof(void*));
+	void *p;
+	long i;
+	int slot;
+
+	for (i = 0; i < w->ops; i += 2) {
+		slot = next_random(w) % WINDOW;
+		if (window[slot])
+			OP(w, free(window[slot]));
+		OP(w, p = calloc(1, random_size(w, 65536)));
+		touch(p);
+		window[slot] = p;
+	}
+	for (slot = 0; slot < WINDOW; slot++)
+		free(window[slot]);
+	munmap(window, WINDOW * sizeof(void*));
+}
+
+struct workload {
+	const char *name;
+	void (*run)(struct worker *w);
+};
+
+static struct workload workloads[] = {
+	{ "fixed", run_fixed },
+	{ "random", run_random },
+	{ "prodcons", run_prodcons },
+	{ "larson", run_larson },
+	{ "realloc", run_realloc },
+	{ "calloc", run_calloc },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static struct workload *current;
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+
+	pthread_barrier_wait(&w->run->barrier);
+	w->start = now_ns();
+	current->run(w);
+	w->end = now_ns();
+	return NULL;
+}
+
+static int compare_unsigned(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned*)a, y = *(const unsigned*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// runs the current workload with the given number of threads and measures it (in the process of the run)
+static void measure(int threads, long ops, struct result *res)
+{
+	struct run run;
+	pthread_t *tids = map_zeroed(threads * sizeof(pthread_t));
+	unsigned *all;
+	unsigned long long start = -1ULL, end = 0;
+	long total = 0, n = 0, i;
+	struct rusage ru;
+	int t;
+
+	memset(&run, 0, sizeof(run));
+	run.threads = threads;
+	run.ops = ops;
+	run.workers = map_zeroed(threads * sizeof(struct worker));
+	run.rings = map_zeroed(threads * sizeof(struct ring));
+	run.windows = map_zeroed(threads * sizeof(void**));
+	atomic_init(&run.producers_left, threads);
+	// the workers start together, and the run lasts from the first one starting to the last one finishing
+	// (timed by the workers themselves, the main thread may not even get the CPU back before they are done)
+	pthread_barrier_init(&run.barrier, NULL, threads);
+	for (t = 0; t < threads; t++) {
+		run.workers[t].id = t;
+		run.workers[t].ops = ops;
+		run.workers[t].rng = 0x9E3779B97F4A7C15ULL * (t + 1);
+		run.workers[t].samples = map_zeroed((ops / SAMPLE_EVERY + 2) * sizeof(unsigned));
+		run.workers[t].run = &run;
+		run.windows[t] = map_zeroed(WINDOW * sizeof(void*));
+	}
+	for (t = 0; t < threads; t++)
+		if (pthread_create(&tids[t], NULL, worker_main, &run.workers[t])) {
+			fprintf(stderr, "bench: cannot create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	for (t = 0; t < threads; t++)
+		pthread_join(tids[t], NULL);
+
+	for (t = 0; t < threads; t++) {
+		if (run.workers[t].start < start)
+			start = run.workers[t].start;
+		if (run.workers[t].end > end)
+			end = run.workers[t].end;
+		total += run.workers[t].counter;
+		n += run.workers[t].num_samples;
+	}
+	all = map_zeroed((n + 1) * sizeof(unsigned));
+	for (t = 0, n = 0; t < threads; t++)
+		for (i = 0; i < run.workers[t].num_samples; i++)
+			all[n++] = run.workers[t].samples[i];
+	qsort(all, n, sizeof(unsigned), compare_unsigned);
+	res->seconds = (end - start) / 1e9;
+	res->total_ops = total;
+	res->p50 = n ? all[n / 2] : 0;
+	res->p99 = n ? all[n * 99 / 100] : 0;
+	getrusage(RUSAGE_SELF, &ru);
+	res->max_rss = ru.ru_maxrss;
+}
+
+// forks a process for the run so that every run starts from a fresh heap and has its own peak RSS
+static int run_forked(int threads, long ops, struct result *res)
+{
+	int fds[2], status;
+	pid_t pid;
+	ssize_t n;
+
+	if (pipe(fds) < 0) {
+		perror("bench: pipe");
+		return -1;
+	}
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		measure(threads, ops, res);
+		if (write(fds[1], res, sizeof(*res)) != sizeof(*res))
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	} else if (pid < 0) {
+		perror("bench: fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	close(fds[1]);
+	n = read(fds[0], res, sizeof(*res));
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	if (n != sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "bench: %s with %d threads failed\n", current->name, threads);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	unsigned i;
+
+	fprintf(stderr, "usage: bench [-n ops per thread] [-t threads,threads,...] [-w workload]...\n");
+	fprintf(stderr, "workloads:");
+	for (i = 0; i < NUM_WORKLOADS; i++)
+		fprintf(stderr, " %s", workloads[i].name);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int threads[16] = { 1, 2, 4, 8 }, num_threads = 4, selected[NUM_WORKLOADS] = { 0 }, any_selected = 0;
+	long ops = DEFAULT_OPS;
+	const char *preload = getenv("LD_PRELOAD");
+	struct result res;
+	char *list, *tok;
+	unsigned i;
+	int opt, t;
+
+	while ((opt = getopt(argc, argv, "n:t:w:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = atol(optarg);
+			if (ops < LARSON_ROUNDS * 2)
+				usage();
+			break;
+		case 't':
+			num_threads = 0;
+			for (list = optarg; (tok = strtok(list, ",")) && num_threads < 16; list = NULL)
+				if ((threads[num_threads++] = atoi(tok)) < 1)
+					usage();
+			break;
+		case 'w':
+			for (i = 0; i < NUM_WORKLOADS && strcmp(workloads[i].name, optarg); i++)
+				;
+			if (i == NUM_WORKLOADS)
+				usage();
+			selected[i] = any_selected = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	printf("malloc: %s\n", preload && *preload ? preload : "glibc");
+	printf("%-10s %7s %14s %9s %9s %12s\n", "workload", "threads", "ops/sec", "p50 (ns)", "p99 (ns)", "peak RSS KB");
+	for (i = 0; i < NUM_WORKLOADS; i++) {
+		if (any_selected && !selected[i])
+			continue;
+		current = &workloads[i];
+		for (t = 0; t < num_threads; t++) {
+			if (run_forked(threads[t], ops, &res) < 0)
+				continue;
+			printf("%-10s %7d %14.0f %9u %9u %12ld\n", current->name, threads[t],
+				res.total_ops / res.seconds, res.p50, res.p99, res.max_rss);
+		}
+	}
+	return 0;
+}
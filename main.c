@@ -1,293 +1,2501 @@
-#include <sys/wait.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-
-/*
-  Function Declarations for builtin shell commands:
-  Added since: "lsh_help() uses the array of builtins, and the arrays contain lsh_help()"
- */
-int lsh_cd(char **args);
-int lsh_help(char **args);
-int lsh_exit(char **args);
-
-/*
-  List of builtin commands, followed by their corresponding functions.
- */
-// array of strings containing the built-in shell commands
-char *builtin_str[] = {
-    "cd",
-    "help",
-    "exit"
-};
-
-// an array of function pointers, each one mapping to a function that uses a built-in shell command
-// function pointers: pointers pointing to function address in memory
-// functions take in string array and return an int
-int (*builtin_func[]) (char **) = {
-    &lsh_cd,
-    &lsh_help,
-    &lsh_exit
-};
-
-// returns # of built-in commands
-int lsh_num_builtins() {
-    return sizeof(builtin_str) / sizeof(char *);
-}
-
-/*
-  Builtin function implementations.
-*/
-// for native cd command
-int lsh_cd(char **args)
-{
-    // to check if second argument exists (ex: cd file, cd directory/file)
-    if (args[1] == NULL) {
-        fprintf(stderr, "lsh: expected argument to \"cd\"\n");
-    } else {
-        // if the directory user wants to change to is not valid, print out error message
-        if (chdir(args[1]) != 0) {
-        perror("lsh");
-        }
-    }
-    
-    // if the directory is valid, tell the shell to keep on running
-    return 1;
-}
-
-// for native help command
-int lsh_help(char **args)
-    {
-    int i;
-    printf("Stephen Brennan's LSH\n");
-    printf("Type program names and arguments, and hit enter.\n");
-    printf("The following are built in:\n");
-
-    // lists all of the built-in shell commands
-    for (i = 0; i < lsh_num_builtins(); i++) {
-        printf("  %s\n", builtin_str[i]);
-    }
-
-    // asks user to refer to the external man command
-    printf("Use the man command for information on other programs.\n");
-
-    // tell the shell to keep on going 
-    return 1;
-}
-
-// if the native exit command is executed, exit the shell program
-int lsh_exit(char **args)
-{
-    return 0;
-}
-
-// takes list of arguments (token array) -> forks the process -> saves return value
-// shells start processes (programs in execution that have a unique PID #), which the kernel controls/manages. Very interesting how it works.
-// A process is made up of an executable program, it's data (with program ptr) and stack (with stack ptr), CPU registers which can be shared between parent and child processes, etc. 
-// the shell itself is a process that creates child processes to execute commands and loops indefinitely, also interesting how system calls work to manipulate processes for shell functionality
-int lsh_launch(char **args)
-{
-    pid_t pid, wpid;                                        // stores processID (PID) returned by fork(), stores PID returned by waitpid()
-    int status;                                             // stores the exit status of the child process 
-
-    // Creates a new process (child process) by duplicating current process (the parent/shell process)
-    // Will either return:
-    // 1. 0: we are in the child process
-    // 2. PID of child process (positive value): returns to parent process or caller after sucessfully creating child process
-    // 3. negative value: returns error
-    pid = fork();
-    if (pid == 0) {
-        // Child process
-        // if we are in child process we want to run command given by user through exec() system call
-        // calls exec() variant to test if first argument in array is a proper command, if not and it returns, print error message
-        if (execvp(args[0], args) == -1) {
-        perror("lsh");
-        }
-        exit(EXIT_FAILURE);
-    } else if (pid < 0) {
-        // Error forking (the fork() call failed)
-        // up to user to decide whether or not to continue, could add exit status here as well 
-        perror("lsh");
-    } else {
-        // Parent process
-        // if none of above, we are in parent process and wait (using waitpid(), a variant of wait system call) for child process to finish
-        // useful so that shell does not execute next command until after current one finishes executing
-        // WIFEXITED(status) = child process exits normally, WIFSIGNALED(status) = child process terminated by signal
-        do {
-        wpid = waitpid(pid, &status, WUNTRACED);
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
-    }
-
-    // indicates that shell should continue running
-    return 1;
-}
-
-// execute the given arguments (char** args == char** tokens)
-int lsh_execute(char **args)
-{
-    int i;
-
-    // if first argument is empty (user enters whitespace and/or hits enter key)
-    if (args[0] == NULL) {
-        // An empty command was entered. 
-        return 1;
-    }
-
-    // loop through the built-in command array to find a match for command entered in by the user (usually at args[0])
-    // if a match is found then the corresponding function pointer is called with arguments array as parameter for function
-    // example: user enters "cd" -> builtin_func[i] points to lsh_cd -> lsh_cd(args) is called/executed
-    for (i = 0; i < lsh_num_builtins(); i++) {
-        if (strcmp(args[0], builtin_str[i]) == 0) {
-        return (*builtin_func[i])(args);
-        }
-    }
-
-    // if the command user enters is not one built into the shell, it calls lsh_launch() to launch process
-    return lsh_launch(args);
-}
-
-/*
-// same purpose as function below, but without using getline() (a line input function)
-// initial size of buffer used to store user input (1 kilobyte or 1024 bytes)
-#define LSH_RL_BUFSIZE 1024
-// reads a line of input from the user and dynamically resizes the buffer if necessary (if input exceeds initial size)
-char *lsh_read_line(void)
-{
- 
-    int bufsize = LSH_RL_BUFSIZE;                           // buffer size (assigned to variable since it can change)
-    int position = 0;                                       // current position in buffer
-    char *buffer = malloc(sizeof(char) * bufsize);          // allocate memory for buffer                          
-    int c;                                                  // stores char from input as ASCII value (an int)
-
-    // if memory allocation fails, error msg printed to stderr and exit program with a failure status
-    if (!buffer) {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-    }
-
-    while (1) {
-        // Read a character from standard input (the terminal)
-        c = getchar();
-
-        // If we hit EOF or a newline, replace it with a null character and return.
-        // else buffer at that current position is assigned the character value 
-        if (c == EOF || c == '\n') {
-            buffer[position] = '\0';
-            return buffer;
-        } else {
-            buffer[position] = c;
-        }
-        position++;                                         // go to next position in buffer by incrementing
-
-        // If we have exceeded the buffer, reallocate.
-        if (position >= bufsize) {
-            bufsize += LSH_RL_BUFSIZE;                      // increase buffer size by 1024 bytes
-            buffer = realloc(buffer, bufsize);              // use this new buffer size as parameter in realloc()
-            // always safe to include this to prevent any errors if memory cannot be allocated
-            if (!buffer) {
-                fprintf(stderr, "lsh: allocation error\n");
-                exit(EXIT_FAILURE);                         // exit program with a failure status
-            }
-        }
-    }
-} */
-
-// for reading a line of input from user using getline()
-char *lsh_read_line(void)
-{
-    char *line = NULL;                                      // where to store the users input line, first initialize to NULL
-    ssize_t bufsize = 0;                                    // have getline allocate a buffer for us
-  
-    if (getline(&line, &bufsize, stdin) == -1){             // when getline() == -1, either error has occured or end of input (EOF) has been reached
-        if (feof(stdin)) {       // checks if EOF was reached 
-            exit(EXIT_SUCCESS);  // We recieved an EOF (line has been successfully stored)
-        } else  {
-            perror("readline");  // if there was an error
-            exit(EXIT_FAILURE);  // exit program with failure status
-        }
-    }
-  
-    return line;                                            // return the line
-}
-
-
-// for parsing through the stored user input line, and separating it into a list of arguments (token array) using strtok()
-// buffer size macro for storing tokens (can initially hold up to 64 tokens)
-#define LSH_TOK_BUFSIZE 64
-// macro defining what delimiters are valid for splitting up the input line (will be used as an argument of strtok())
-#define LSH_TOK_DELIM " \t\r\n\a"
-char **lsh_split_line(char *line)
-{
-    int bufsize = LSH_TOK_BUFSIZE, position = 0;            // bufsize = current size of tokens array, position = current location in tokens array (the tokens array is where we will be storing our args)
-    char **tokens = malloc(bufsize * sizeof(char*));        // allocate memory for tokens array
-    char *token;                                            // a token (arg) strtok() will point to 
-
-    // checks if the memory allocation for tokens array failed
-    if (!tokens) {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // splits the line into tokens (parses the line) based on the delimiter's
-    // first call returns first token within input line
-    token = strtok(line, LSH_TOK_DELIM);
-    // while ptr returned by strtok does not reach end of string line
-    while (token != NULL) {
-        // insert the pointer to token in the tokens array and move to next empty position
-        tokens[position] = token;
-        position++;
-
-        // to dynamically grow out the size of tokens array, and check if the memory allocation failed
-        if (position >= bufsize) {
-        bufsize += LSH_TOK_BUFSIZE;
-        tokens = realloc(tokens, bufsize * sizeof(char*));
-        if (!tokens) {
-            fprintf(stderr, "lsh: allocation error\n");
-            exit(EXIT_FAILURE);
-        }
-        }
-        // tells strtok() to continue on to the next token in the string (input line) with regards to the delimiter 
-        // passing NULL as first argument continues tokenization (splitting line into args)
-        token = strtok(NULL, LSH_TOK_DELIM);
-    }
-    // Null-terminate array (many functions that process string arrays expect it to be null-terminated)
-    tokens[position] = NULL;
-    // return the token array
-    return tokens;
-}
-
-// loop gets input from the user and executes it
-void lsh_loop(void)
-{
-    char *line;                                         // pointer to string holding user input
-    char **args;                                        // pointer to array of strings (arguments) from splitting the input line from user
-    int status;                                         // indicates whether shell should keep running or not
-
-    do {
-        printf("> ");                                   // 1. print prompt
-        line = lsh_read_line();                         // 2. read the line from user (we call a function for it)
-        args = lsh_split_line(line);                    // 3. split the line into args (we call a function for it)
-        status = lsh_execute(args);                     // 4. Execute those args, also determines whether or not shell should keep on running (we call a function for it)
-
-        // free pointers for line and arguments
-        free(line);
-        free(args);
-    } while (status);
-}
-
-// argc = argument count [holds # of command line arguments passed to program, includes program name itself]
-// argv = argument vector [array of strings (or specifically char*  pointers) containing the command-line arguments passed into program]
-int main(int argc, char **argv)
-{
-    // Load config files, if any.
-
-    // Run command loop.
-    lsh_loop();
-
-    // Perform any shutdown/cleanup.
-
-    // typically returns 0, indicates successful program termination
-    return EXIT_SUCCESS;
+// for splice() (and SPLICE_F_MOVE) from fcntl.h
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <malloc.h>
+#include <stddef.h>
+
+/*
+  Function Declarations for builtin shell commands:
+  Added since: "lsh_help() uses the array of builtins, and the arrays contain lsh_help()"
+ */
+int lsh_cd(char **args);
+int lsh_help(char **args);
+int lsh_exit(char **args);
+int lsh_jobs(char **args);
+int lsh_fg(char **args);
+int lsh_bg(char **args);
+int lsh_hash_builtin(char **args);
+int lsh_cat(char **args);
+int lsh_alias(char **args);
+int lsh_unalias(char **args);
+int lsh_time(char **args);
+int lsh_parallel(char **args);
+
+/*
+  List of builtin commands, each with the function that runs it.
+  This table is the one place a new built-in has to be added (after declaring its function above):
+  lsh_init_names() puts every entry in the name table that commands are looked up in.
+ */
+struct lsh_builtin {
+    char *name;                                             // what the user types to run it
+    int (*func) (char **);                                  // function pointer: takes in string array (the arguments) and returns an int (0 = exit the shell)
+};
+
+struct lsh_builtin builtins[] = {
+    { "cd", &lsh_cd },
+    { "help", &lsh_help },
+    { "exit", &lsh_exit },
+    { "jobs", &lsh_jobs },
+    { "fg", &lsh_fg },
+    { "bg", &lsh_bg },
+    { "hash", &lsh_hash_builtin },
+    { "cat", &lsh_cat },
+    { "alias", &lsh_alias },
+    { "unalias", &lsh_unalias },
+    { "time", &lsh_time },
+    { "parallel", &lsh_parallel }
+};
+
+// returns # of built-in commands
+int lsh_num_builtins() {
+    return sizeof(builtins) / sizeof(struct lsh_builtin);
+}
+
+/*
+  Per-line arena.
+ */
+// memory for whatever is built while parsing a line (the token array) is handed out from an arena, and the whole arena
+// is emptied at once before the next line. Once it has grown to fit the biggest line seen so far, parsing a line
+// doesn't call malloc()/free() at all (the old way was a malloc() and a free() per line, plus a realloc() per 64 tokens)
+#define LSH_ARENA_SIZE 4096
+
+struct lsh_arena_block {
+    struct lsh_arena_block *prev;                           // block that filled up before this one
+    size_t size;                                            // bytes in data[]
+    size_t used;                                            // bytes of data[] handed out
+    char data[];
+};
+
+// newest block of the arena (the one being handed out from)
+struct lsh_arena_block *lsh_arena;
+
+// returns size bytes from the arena, valid until the next lsh_arena_reset()
+void *lsh_arena_alloc(size_t size)
+{
+    struct lsh_arena_block *block = lsh_arena;
+    size_t want;
+
+    // keep everything pointer-aligned
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (block == NULL || block->size - block->used < size) {
+        // chain a new block at least twice as big as the last one (and big enough for the request)
+        want = block ? block->size * 2 : LSH_ARENA_SIZE;
+        while (want < size) {
+            want *= 2;
+        }
+        block = malloc(sizeof(struct lsh_arena_block) + want);
+        if (!block) {
+            fprintf(stderr, "lsh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        block->prev = lsh_arena;
+        block->size = want;
+        block->used = 0;
+        lsh_arena = block;
+    }
+    block->used += size;
+    return block->data + block->used - size;
+}
+
+// empties the arena for the next line. A line that needed more than one block leaves one block that holds all of it,
+// so a line like it fits in a single block next time
+void lsh_arena_reset(void)
+{
+    struct lsh_arena_block *block = lsh_arena, *prev;
+    size_t total = 0;
+
+    if (block == NULL) {
+        return;
+    }
+    if (block->prev == NULL) {
+        block->used = 0;
+        return;
+    }
+    for (; block != NULL; block = prev) {
+        prev = block->prev;
+        total += block->size;
+        free(block);
+    }
+    lsh_arena = NULL;
+    lsh_arena_alloc(total);
+    lsh_arena->used = 0;
+}
+
+/*
+  Exit status and resource usage.
+ */
+// $? : exit status of the last foreground command (0 = success, 128 + n = killed or stopped by signal n, 127 = not found)
+int lsh_status = 0;
+// $! : process group of the last background job
+pid_t lsh_last_background = 0;
+// time -a on: report the resource usage of every foreground command, not only of the ones run with time in front
+int lsh_time_always = 0;
+// set by lsh_execute_one() while it runs a command that has time in front of it
+int lsh_timed = 0;
+
+// what the last foreground command (all processes of the pipeline together) used, shown by time and in $TIME_*
+struct lsh_usage {
+    double real;                                            // wall clock seconds from start to finish
+    double user;                                            // CPU seconds in user mode
+    double sys;                                             // CPU seconds in the kernel
+    long maxrss;                                            // largest resident set of any of its processes, in KB
+    long minflt;                                            // page faults served without I/O
+    long majflt;                                            // page faults that needed I/O
+    long nvcsw;                                             // voluntary context switches (blocked waiting for something)
+    long nivcsw;                                            // involuntary context switches (preempted)
+};
+
+struct lsh_usage lsh_last_usage;
+// how many times lsh_last_usage was filled in (a built-in like fg reports the job it waited for, not itself)
+int lsh_usage_reports = 0;
+
+// returns seconds in a timeval / seconds from start until end / seconds from start until now
+double lsh_seconds(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+double lsh_interval(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double lsh_elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return lsh_interval(start, &now);
+}
+
+// adds one process's rusage to usage (maxrss is the biggest one, not a sum)
+void lsh_add_rusage(struct lsh_usage *usage, struct rusage *ru)
+{
+    usage->user += lsh_seconds(&ru->ru_utime);
+    usage->sys += lsh_seconds(&ru->ru_stime);
+    if (ru->ru_maxrss > usage->maxrss) {
+        usage->maxrss = ru->ru_maxrss;
+    }
+    usage->minflt += ru->ru_minflt;
+    usage->majflt += ru->ru_majflt;
+    usage->nvcsw += ru->ru_nvcsw;
+    usage->nivcsw += ru->ru_nivcsw;
+}
+
+// prints what a command used to stderr (so it doesn't end up in the command's own output)
+void lsh_print_usage(struct lsh_usage *usage, char *command)
+{
+    fprintf(stderr, "%s: real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KB  faults %ld minor / %ld major  ctxsw %ld voluntary / %ld involuntary\n",
+            command, usage->real, usage->user, usage->sys, usage->maxrss, usage->minflt, usage->majflt, usage->nvcsw, usage->nivcsw);
+}
+
+// records what a foreground command used for $TIME_*, and prints it if it was timed (or every command is)
+void lsh_report_usage(struct lsh_usage *usage, char *command, int timed)
+{
+    lsh_usage_reports++;
+    lsh_last_usage = *usage;
+    if (timed || lsh_time_always) {
+        lsh_print_usage(usage, command);
+    }
+}
+
+/*
+  Job control.
+ */
+// every pipeline the shell starts is a job: its processes share one process group (named after the first stage's PID),
+// so the terminal and signals like SIGCONT can be handed to all of them at once
+// the jobs[] table is updated by the SIGCHLD handler as the processes stop, continue or exit; anything else that touches it
+// blocks SIGCHLD first (see lsh_block_sigchld()) so the handler never sees a job that is only half set up or half freed
+#define LSH_MAX_JOBS 64
+
+// what a process (or a whole job) is doing
+#define LSH_RUNNING 0
+#define LSH_STOPPED 1
+#define LSH_DONE 2
+
+// one process of a job (one stage of the pipeline)
+struct lsh_process {
+    pid_t pid;
+    volatile sig_atomic_t state;                            // LSH_RUNNING, LSH_STOPPED or LSH_DONE, written by the SIGCHLD handler
+    int status;                                             // last status wait4() reported for it
+    struct rusage ru;                                       // what it used, filled in once it has exited
+    struct timespec end;                                    // when it exited
+};
+
+struct lsh_job {
+    int id;                                                 // job number shown as [n] and used by fg/bg (0 = free slot)
+    pid_t pgid;                                             // process group of the job
+    char *command;                                          // command line the job was started with (shown by jobs)
+    struct lsh_process *procs;                              // one entry per stage
+    int nprocs;
+    int background;                                         // 1 while the job is not in the foreground
+    struct termios tmodes;                                  // terminal modes to restore when the job is brought back to the foreground
+    int status;                                             // exit status when the last stage couldn't be started, otherwise -1 (taken from the last process)
+    int timed;                                              // started with time in front of it
+    struct timespec start;                                  // when it was started (for its wall clock time)
+};
+
+struct lsh_job jobs[LSH_MAX_JOBS];
+
+// set by main() when stdin is a terminal: the shell then hands the terminal to each foreground job and takes it back afterwards
+int lsh_interactive = 0;
+// process group of the shell itself (where the terminal goes back to once a job stops or finishes)
+pid_t lsh_pgid;
+// terminal modes of the shell, restored whenever it takes the terminal back (a job like vi may have changed them)
+struct termios lsh_tmodes;
+
+// blocks SIGCHLD and stores the previous signal mask in old (pass it to lsh_restore_sigmask() or sigsuspend())
+void lsh_block_sigchld(sigset_t *old)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, old);
+}
+
+void lsh_restore_sigmask(sigset_t *old)
+{
+    sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+// records what wait4() said about the process pid in the job it belongs to
+void lsh_mark_process(pid_t pid, int status, struct rusage *ru)
+{
+    int i, j;
+
+    for (i = 0; i < LSH_MAX_JOBS; i++) {
+        for (j = 0; jobs[i].id != 0 && j < jobs[i].nprocs; j++) {
+            if (jobs[i].procs[j].pid == pid) {
+                jobs[i].procs[j].status = status;
+                if (WIFSTOPPED(status)) {
+                    jobs[i].procs[j].state = LSH_STOPPED;
+                } else if (WIFCONTINUED(status)) {
+                    jobs[i].procs[j].state = LSH_RUNNING;
+                } else {
+                    jobs[i].procs[j].state = LSH_DONE;
+                    jobs[i].procs[j].ru = *ru;
+                    clock_gettime(CLOCK_MONOTONIC, &jobs[i].procs[j].end);
+                }
+                return;
+            }
+        }
+    }
+}
+
+// SIGCHLD handler: collects every child that changed state, so finished background jobs don't linger as zombies
+// and nothing has to poll for them. WNOHANG since one signal can stand for several children (signals don't queue)
+// wait4() is waitpid() that also hands back the resource usage of a child that exited, for time and $TIME_*
+void lsh_sigchld(int sig)
+{
+    int saved_errno = errno;                                // wait4() may change errno under the code we interrupted
+    struct rusage ru;
+    int status;
+    pid_t pid;
+
+    (void) sig;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        lsh_mark_process(pid, status, &ru);
+    }
+    errno = saved_errno;
+}
+
+// a job is running while any of its processes is, stopped once the rest have stopped (or exited), and done when all have exited
+int lsh_job_state(struct lsh_job *job)
+{
+    int i, stopped = 0;
+
+    for (i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].state == LSH_RUNNING) {
+            return LSH_RUNNING;
+        }
+        stopped |= job->procs[i].state == LSH_STOPPED;
+    }
+    return stopped ? LSH_STOPPED : LSH_DONE;
+}
+
+// takes a free slot in jobs[] for a new job (SIGCHLD must be blocked); job numbers count up from the highest one in use like bash
+struct lsh_job *lsh_new_job(char **args, int nprocs, int background)
+{
+    struct lsh_job *job = NULL;
+    size_t len = 0;
+    int i, id = 0;
+
+    for (i = 0; i < LSH_MAX_JOBS; i++) {
+        if (jobs[i].id == 0 && job == NULL) {
+            job = &jobs[i];
+        } else if (jobs[i].id > id) {
+            id = jobs[i].id;
+        }
+    }
+    if (job == NULL) {
+        fprintf(stderr, "lsh: too many jobs\n");
+        return NULL;
+    }
+
+    // keep a copy of the command line (the tokens point into the line buffer, which is freed after the command runs)
+    for (i = 0; args[i] != NULL; i++) {
+        len += strlen(args[i]) + 1;
+    }
+    job->command = malloc(len + 1);
+    job->procs = calloc(nprocs, sizeof(struct lsh_process));
+    if (!job->command || !job->procs) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    job->command[0] = '\0';
+    for (i = 0; args[i] != NULL; i++) {
+        if (i > 0) {
+            strcat(job->command, " ");
+        }
+        strcat(job->command, args[i]);
+    }
+
+    job->pgid = 0;
+    job->nprocs = 0;
+    job->background = background;
+    job->tmodes = lsh_tmodes;
+    job->status = -1;
+    job->timed = lsh_timed;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->id = id + 1;
+    return job;
+}
+
+// gives the slot back once the job is done (SIGCHLD must be blocked)
+void lsh_free_job(struct lsh_job *job)
+{
+    job->id = 0;
+    free(job->command);
+    free(job->procs);
+    job->command = NULL;
+    job->procs = NULL;
+}
+
+// finds the job named by a fg/bg/jobs argument ("%2" or "2"), or the most recent job when there is none
+struct lsh_job *lsh_find_job(char *arg)
+{
+    struct lsh_job *job = NULL;
+    int i, id = 0;
+
+    if (arg != NULL) {
+        id = atoi(arg[0] == '%' ? arg + 1 : arg);
+    }
+    for (i = 0; i < LSH_MAX_JOBS; i++) {
+        if (jobs[i].id == 0) {
+            continue;
+        }
+        if (id ? jobs[i].id == id : (job == NULL || jobs[i].id > job->id)) {
+            job = &jobs[i];
+        }
+    }
+    return job;
+}
+
+// exit status of a job for $?: the last stage's, like other shells
+int lsh_job_status(struct lsh_job *job)
+{
+    int status;
+
+    if (job->status >= 0 || job->nprocs == 0) {
+        return job->status >= 0 ? job->status : 1;
+    }
+    status = job->procs[job->nprocs - 1].status;
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 128 + WSTOPSIG(status);
+}
+
+// adds up what the processes of a job that finished used (its wall clock time ends when the last of them exited)
+void lsh_job_usage(struct lsh_job *job, struct lsh_usage *usage)
+{
+    double real;
+    int i;
+
+    memset(usage, 0, sizeof(*usage));
+    for (i = 0; i < job->nprocs; i++) {
+        lsh_add_rusage(usage, &job->procs[i].ru);
+        if ((real = lsh_interval(&job->start, &job->procs[i].end)) > usage->real) {
+            usage->real = real;
+        }
+    }
+}
+
+// waits until the foreground job stops or exits (SIGCHLD must be blocked)
+// sigsuspend() atomically unblocks SIGCHLD and sleeps, so the handler has updated jobs[] every time we wake up
+// and a child that exits between the check and the sleep can't be missed
+void lsh_wait_job(struct lsh_job *job, sigset_t *unblocked)
+{
+    struct lsh_usage usage;
+    int i, early;
+
+    do {
+        while (lsh_job_state(job) == LSH_RUNNING) {
+            sigsuspend(unblocked);
+        }
+
+        // a spawned stage can't take the terminal itself, so it may touch it in the moment before the shell hands it over
+        // and get stopped by SIGTTIN/SIGTTOU. The job owns the terminal now, so just let it carry on
+        early = 0;
+        for (i = 0; lsh_interactive && i < job->nprocs; i++) {
+            if (job->procs[i].state == LSH_STOPPED && tcgetpgrp(STDIN_FILENO) == job->pgid
+                && (WSTOPSIG(job->procs[i].status) == SIGTTIN || WSTOPSIG(job->procs[i].status) == SIGTTOU)) {
+                job->procs[i].state = LSH_RUNNING;
+                early = 1;
+            }
+        }
+        if (early) {
+            kill(-job->pgid, SIGCONT);
+        }
+    } while (early);
+
+    // take the terminal back so the shell can read the next command, and put its terminal modes back
+    if (lsh_interactive) {
+        tcsetpgrp(STDIN_FILENO, lsh_pgid);
+        tcgetattr(STDIN_FILENO, &job->tmodes);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &lsh_tmodes);
+    }
+
+    lsh_status = lsh_job_status(job);
+    if (lsh_job_state(job) == LSH_STOPPED) {
+        // Ctrl-Z: the job stays in the table (in the background) until fg/bg picks it up again
+        job->background = 1;
+        printf("\n[%d]+  Stopped                 %s\n", job->id, job->command);
+    } else {
+        lsh_job_usage(job, &usage);
+        lsh_report_usage(&usage, job->command, job->timed || lsh_timed);
+        lsh_free_job(job);
+    }
+}
+
+// puts a job in the foreground: gives it the terminal, continues it if it was stopped, and waits for it (SIGCHLD must be blocked)
+void lsh_foreground_job(struct lsh_job *job, int cont, sigset_t *unblocked)
+{
+    int i;
+
+    job->background = 0;
+    if (lsh_interactive) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        if (cont) {
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+        }
+    }
+    if (cont) {
+        for (i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].state == LSH_STOPPED) {
+                job->procs[i].state = LSH_RUNNING;
+            }
+        }
+        kill(-job->pgid, SIGCONT);
+    }
+    lsh_wait_job(job, unblocked);
+}
+
+// reports background jobs that finished since the last prompt (like bash's "[1]+  Done") and frees them
+void lsh_notify_jobs(void)
+{
+    struct lsh_usage usage;
+    sigset_t old;
+    int i;
+
+    lsh_block_sigchld(&old);
+    for (i = 0; i < LSH_MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && jobs[i].background && lsh_job_state(&jobs[i]) == LSH_DONE) {
+            if (lsh_interactive) {
+                printf("[%d]   Done                    %s\n", jobs[i].id, jobs[i].command);
+            }
+            // time ... & reports when the job is done (without touching $? and $TIME_*, which belong to foreground commands)
+            if (jobs[i].timed) {
+                lsh_job_usage(&jobs[i], &usage);
+                lsh_print_usage(&usage, jobs[i].command);
+            }
+            lsh_free_job(&jobs[i]);
+        }
+    }
+    lsh_restore_sigmask(&old);
+}
+
+/*
+  Command lookup.
+ */
+// full path of every command found in PATH so far (like bash's hash builtin), so running the same command again doesn't
+// mean trying every PATH directory in turn like execvp() does. The table is thrown away whenever PATH changes
+#define LSH_HASH_SIZE 256
+
+// the programs started by lsh_launch() get the shell's environment
+extern char **environ;
+
+struct lsh_hashed {
+    char *name;                                             // command name as typed (ex: ls)
+    char *path;                                             // where it was found (ex: /usr/bin/ls)
+    int hits;                                               // how many times the entry was used (shown by hash)
+    struct lsh_hashed *next;                                // next entry in the same bucket
+};
+
+struct lsh_hashed *lsh_path_table[LSH_HASH_SIZE];
+// PATH the table was filled for
+char *lsh_hashed_path;
+
+// FNV-1a hash of a string
+unsigned int lsh_hash(const char *str)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*str != '\0') {
+        hash = (hash ^ (unsigned char) *str++) * 16777619u;
+    }
+    return hash;
+}
+
+// forgets every command in the table (hash -r, or PATH changed)
+void lsh_hash_clear(void)
+{
+    struct lsh_hashed *entry, *next;
+    int i;
+
+    for (i = 0; i < LSH_HASH_SIZE; i++) {
+        for (entry = lsh_path_table[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+        lsh_path_table[i] = NULL;
+    }
+}
+
+// returns the address of the link that points to the entry for name (or of the NULL at the end of its bucket)
+struct lsh_hashed **lsh_hash_slot(char *name)
+{
+    struct lsh_hashed **slot = &lsh_path_table[lsh_hash(name) % LSH_HASH_SIZE];
+
+    while (*slot != NULL && strcmp((*slot)->name, name) != 0) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+// drops one command from the table (its file went away since it was found)
+void lsh_hash_forget(char *name)
+{
+    struct lsh_hashed **slot = lsh_hash_slot(name), *entry = *slot;
+
+    if (entry != NULL) {
+        *slot = entry->next;
+        free(entry->name);
+        free(entry->path);
+        free(entry);
+    }
+}
+
+// tries every directory of path in order (an empty one means the current directory) and returns the first executable
+// regular file called name, in memory from malloc(), or NULL
+char *lsh_search_path(char *path, char *name)
+{
+    size_t len = strlen(name), dirlen;
+    char *full, *end;
+    struct stat st;
+
+    full = malloc(strlen(path) + len + 3);
+    if (!full) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        end = strchr(path, ':');
+        dirlen = end ? (size_t) (end - path) : strlen(path);
+        if (dirlen == 0) {
+            full[0] = '.';
+            dirlen = 1;
+        } else {
+            memcpy(full, path, dirlen);
+        }
+        full[dirlen] = '/';
+        memcpy(full + dirlen + 1, name, len + 1);
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            return full;
+        }
+        if (end == NULL) {
+            break;
+        }
+        path = end + 1;
+    }
+    free(full);
+    return NULL;
+}
+
+// returns the file to run for the command name: name itself if it has a "/" in it, otherwise where it is in PATH
+// (from the table when it was looked up before), or NULL if it isn't anywhere in PATH
+char *lsh_find_command(char *name)
+{
+    struct lsh_hashed **slot, *entry;
+    char *path = getenv("PATH"), *full;
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    // same default as execvp() when PATH isn't set
+    if (path == NULL) {
+        path = "/bin:/usr/bin";
+    }
+    // PATH changed since the table was filled (or this is the first lookup): every entry may be wrong now
+    if (lsh_hashed_path == NULL || strcmp(lsh_hashed_path, path) != 0) {
+        lsh_hash_clear();
+        free(lsh_hashed_path);
+        lsh_hashed_path = strdup(path);
+    }
+
+    slot = lsh_hash_slot(name);
+    if (*slot != NULL) {
+        (*slot)->hits++;
+        return (*slot)->path;
+    }
+    if ((full = lsh_search_path(path, name)) == NULL) {
+        return NULL;
+    }
+    entry = malloc(sizeof(struct lsh_hashed));
+    if (!entry || !(entry->name = strdup(name))) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    entry->path = full;
+    entry->hits = 1;
+    entry->next = NULL;
+    *slot = entry;
+    return full;
+}
+
+/*
+  Name table.
+ */
+// every built-in and alias by name, in one hash table: finding out what the first word of a command is takes one lookup
+// no matter how many built-ins there are (instead of a strcmp() against each of them in turn)
+#define LSH_NAMES_SIZE 128
+// how many aliases deep one command can expand (alias a='b x', alias b='c y', ...)
+#define LSH_ALIAS_DEPTH 16
+// characters an alias name can't have in it (it has to come out of the tokenizer as one plain word)
+#define LSH_ALIAS_BAD_CHARS " \t\r\n\a|&;<>'\"\\/$`#"
+
+struct lsh_name {
+    char *name;
+    struct lsh_builtin *builtin;                            // built-in of that name, or NULL (then name is from malloc())
+    char *alias;                                            // what the alias expands to (from malloc()), or NULL
+    struct lsh_name *next;                                  // next entry in the same bucket
+};
+
+struct lsh_name *lsh_names[LSH_NAMES_SIZE];
+
+// defined with the line parsing further down (alias uses it to check a value before storing it)
+char **lsh_split_line(char *line);
+
+// returns the entry for name, or NULL if it's neither a built-in nor an alias; create = 1 adds an empty entry instead
+struct lsh_name *lsh_lookup_name(char *name, int create)
+{
+    struct lsh_name **slot = &lsh_names[lsh_hash(name) % LSH_NAMES_SIZE], *entry;
+
+    for (entry = *slot; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    entry = calloc(1, sizeof(struct lsh_name));
+    if (!entry || !(entry->name = strdup(name))) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    entry->next = *slot;
+    *slot = entry;
+    return entry;
+}
+
+// takes an alias out of the table (the entry stays if it's also a built-in)
+void lsh_remove_alias(struct lsh_name *entry)
+{
+    struct lsh_name **slot = &lsh_names[lsh_hash(entry->name) % LSH_NAMES_SIZE];
+
+    free(entry->alias);
+    entry->alias = NULL;
+    if (entry->builtin != NULL) {
+        return;
+    }
+    while (*slot != entry) {
+        slot = &(*slot)->next;
+    }
+    *slot = entry->next;
+    free(entry->name);
+    free(entry);
+}
+
+// registers every entry of builtins[]
+void lsh_init_names(void)
+{
+    struct lsh_name *entry;
+    int i;
+
+    for (i = 0; i < lsh_num_builtins(); i++) {
+        entry = lsh_lookup_name(builtins[i].name, 1);
+        free(entry->name);
+        entry->name = builtins[i].name;
+        entry->builtin = &builtins[i];
+    }
+}
+
+// returns the built-in called name, or NULL
+struct lsh_builtin *lsh_lookup_builtin(char *name)
+{
+    struct lsh_name *entry = lsh_lookup_name(name, 0);
+
+    return entry ? entry->builtin : NULL;
+}
+
+/*
+  Builtin function implementations.
+*/
+// for native cd command
+int lsh_cd(char **args)
+{
+    // to check if second argument exists (ex: cd file, cd directory/file)
+    if (args[1] == NULL) {
+        fprintf(stderr, "lsh: expected argument to \"cd\"\n");
+        lsh_status = 1;
+    } else {
+        // if the directory user wants to change to is not valid, print out error message
+        if (chdir(args[1]) != 0) {
+        perror("lsh");
+        lsh_status = 1;
+        }
+    }
+    
+    // if the directory is valid, tell the shell to keep on running
+    return 1;
+}
+
+// for native help command
+int lsh_help(char **args)
+    {
+    int i;
+    printf("Stephen Brennan's LSH\n");
+    printf("Type program names and arguments, and hit enter.\n");
+    printf("The following are built in:\n");
+
+    // lists all of the built-in shell commands
+    for (i = 0; i < lsh_num_builtins(); i++) {
+        printf("  %s\n", builtins[i].name);
+    }
+
+    // asks user to refer to the external man command
+    printf("Use the man command for information on other programs.\n");
+
+    // tell the shell to keep on going 
+    return 1;
+}
+
+// if the native exit command is executed, exit the shell program
+// exit n leaves with status n, plain exit with the status of the last command
+int lsh_exit(char **args)
+{
+    if (args[1] != NULL) {
+        lsh_status = atoi(args[1]) & 0xff;
+    }
+    return 0;
+}
+
+// lists the jobs the shell knows about (background and stopped pipelines)
+int lsh_jobs(char **args)
+{
+    static char *state_str[] = { "Running", "Stopped", "Done" };
+    sigset_t old;
+    int i;
+
+    (void) args;
+    lsh_block_sigchld(&old);
+    for (i = 0; i < LSH_MAX_JOBS; i++) {
+        if (jobs[i].id != 0) {
+            printf("[%d]   %-24s%s\n", jobs[i].id, state_str[lsh_job_state(&jobs[i])], jobs[i].command);
+            // a finished job is reported once, here or before the next prompt
+            if (lsh_job_state(&jobs[i]) == LSH_DONE) {
+                lsh_free_job(&jobs[i]);
+            }
+        }
+    }
+    lsh_restore_sigmask(&old);
+    return 1;
+}
+
+// brings a background or stopped job (fg %n, or the most recent one) to the foreground and waits for it
+int lsh_fg(char **args)
+{
+    struct lsh_job *job;
+    sigset_t old;
+
+    lsh_block_sigchld(&old);
+    job = lsh_find_job(args[1]);
+    if (job == NULL) {
+        fprintf(stderr, "lsh: fg: no such job\n");
+        lsh_status = 1;
+    } else {
+        printf("%s\n", job->command);
+        fflush(stdout);
+        lsh_foreground_job(job, 1, &old);
+    }
+    lsh_restore_sigmask(&old);
+    return 1;
+}
+
+// lets a stopped job (bg %n, or the most recent one) carry on running in the background
+int lsh_bg(char **args)
+{
+    struct lsh_job *job;
+    sigset_t old;
+    int i;
+
+    lsh_block_sigchld(&old);
+    job = lsh_find_job(args[1]);
+    if (job == NULL) {
+        fprintf(stderr, "lsh: bg: no such job\n");
+        lsh_status = 1;
+    } else {
+        for (i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].state == LSH_STOPPED) {
+                job->procs[i].state = LSH_RUNNING;
+            }
+        }
+        job->background = 1;
+        printf("[%d]+ %s &\n", job->id, job->command);
+        kill(-job->pgid, SIGCONT);
+    }
+    lsh_restore_sigmask(&old);
+    return 1;
+}
+
+// hash: lists the commands remembered from PATH, hash -r forgets them all, hash name... looks the names up right away
+int lsh_hash_builtin(char **args)
+{
+    struct lsh_hashed *entry;
+    int i;
+
+    if (args[1] == NULL) {
+        printf("hits\tcommand\n");
+        for (i = 0; i < LSH_HASH_SIZE; i++) {
+            for (entry = lsh_path_table[i]; entry != NULL; entry = entry->next) {
+                printf("%4d\t%s\n", entry->hits, entry->path);
+            }
+        }
+    } else if (strcmp(args[1], "-r") == 0) {
+        lsh_hash_clear();
+    } else {
+        for (i = 1; args[i] != NULL; i++) {
+            if (lsh_find_command(args[i]) == NULL) {
+                fprintf(stderr, "lsh: hash: %s: not found\n", args[i]);
+                lsh_status = 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// how much one sendfile()/splice() call is asked to move
+#define LSH_COPY_CHUNK (1 << 30)
+// buffer for the read()/write() fallback
+#define LSH_COPY_BUFSIZE 65536
+
+// copies everything from descriptor in to descriptor out without the data passing through the shell when the kernel can do it:
+// sendfile() when in is a file (to a pipe, file or socket), splice() when either side is a pipe, read()/write() otherwise (ex: a terminal)
+// returns 0, or -1 with errno set
+int lsh_copy_fd(int in, int out)
+{
+    static char buf[LSH_COPY_BUFSIZE];
+    ssize_t got, put, done;
+    int how = 0;                                            // 0 = sendfile(), 1 = splice(), 2 = read()/write()
+
+    for (;;) {
+        if (how == 0) {
+            got = sendfile(out, in, NULL, LSH_COPY_CHUNK);
+        } else if (how == 1) {
+            got = splice(in, NULL, out, NULL, LSH_COPY_CHUNK, SPLICE_F_MOVE);
+        } else {
+            got = read(in, buf, sizeof(buf));
+            for (done = 0; got > 0 && done < got; done += put) {
+                if ((put = write(out, buf + done, got - done)) < 0) {
+                    if (errno == EINTR) {
+                        put = 0;
+                        continue;
+                    }
+                    return -1;
+                }
+            }
+        }
+        // EINVAL straight away means this way doesn't work for these two descriptors: try the next one
+        if (got < 0 && (errno == EINVAL || errno == ENOSYS) && how < 2) {
+            how++;
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return got < 0 ? -1 : 0;
+        }
+    }
+}
+
+// cat: copies the files (stdin for - or when there are none) to stdout, see lsh_copy_fd()
+// (ex: cat big.log | grep x: the log goes from the page cache into the pipe without being copied through the shell)
+int lsh_cat(char **args)
+{
+    static char *stdin_only[] = { "-", NULL };
+    char **files = args[1] != NULL ? args + 1 : stdin_only;
+    int i, fd;
+
+    // anything the shell printed before has to come out first
+    fflush(stdout);
+    for (i = 0; files[i] != NULL; i++) {
+        fd = strcmp(files[i], "-") == 0 ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "lsh: cat: %s: %s\n", files[i], strerror(errno));
+            lsh_status = 1;
+            continue;
+        }
+        if (lsh_copy_fd(fd, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "lsh: cat: %s: %s\n", files[i], strerror(errno));
+            lsh_status = 1;
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    return 1;
+}
+
+// alias: lists the aliases, alias name shows one, alias name=value defines one
+// the value is split like a command line where it is used, so it can hold arguments, quotes and operators (ex: alias ll='ls -l | less')
+int lsh_alias(char **args)
+{
+    struct lsh_name *entry;
+    char *eq, *copy;
+    int i;
+
+    if (args[1] == NULL) {
+        for (i = 0; i < LSH_NAMES_SIZE; i++) {
+            for (entry = lsh_names[i]; entry != NULL; entry = entry->next) {
+                if (entry->alias != NULL) {
+                    printf("alias %s='%s'\n", entry->name, entry->alias);
+                }
+            }
+        }
+        return 1;
+    }
+
+    for (i = 1; args[i] != NULL; i++) {
+        if ((eq = strchr(args[i], '=')) == NULL) {
+            entry = lsh_lookup_name(args[i], 0);
+            if (entry != NULL && entry->alias != NULL) {
+                printf("alias %s='%s'\n", entry->name, entry->alias);
+            } else {
+                fprintf(stderr, "lsh: alias: %s: not found\n", args[i]);
+                lsh_status = 1;
+            }
+            continue;
+        }
+        if (eq == args[i] || strcspn(args[i], LSH_ALIAS_BAD_CHARS) < (size_t) (eq - args[i])) {
+            fprintf(stderr, "lsh: alias: `%s': invalid alias name\n", args[i]);
+            lsh_status = 1;
+            continue;
+        }
+        *eq = '\0';
+        // a value with an unterminated quote would fail every time the alias is used, so refuse it now (the tokenizer reports it)
+        copy = lsh_arena_alloc(strlen(eq + 1) + 1);
+        strcpy(copy, eq + 1);
+        if (lsh_split_line(copy) != NULL) {
+            entry = lsh_lookup_name(args[i], 1);
+            free(entry->alias);
+            if (!(entry->alias = strdup(eq + 1))) {
+                fprintf(stderr, "lsh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            lsh_status = 1;
+        }
+        *eq = '=';
+    }
+    return 1;
+}
+
+// unalias name...: forgets aliases, unalias -a forgets all of them
+int lsh_unalias(char **args)
+{
+    struct lsh_name *entry, *next;
+    int i;
+
+    if (args[1] != NULL && strcmp(args[1], "-a") == 0) {
+        for (i = 0; i < LSH_NAMES_SIZE; i++) {
+            for (entry = lsh_names[i]; entry != NULL; entry = next) {
+                next = entry->next;
+                if (entry->alias != NULL) {
+                    lsh_remove_alias(entry);
+                }
+            }
+        }
+        return 1;
+    }
+    if (args[1] == NULL) {
+        fprintf(stderr, "lsh: unalias: usage: unalias [-a] name...\n");
+        lsh_status = 2;
+    }
+    for (i = 1; args[i] != NULL; i++) {
+        entry = lsh_lookup_name(args[i], 0);
+        if (entry == NULL || entry->alias == NULL) {
+            fprintf(stderr, "lsh: unalias: %s: not found\n", args[i]);
+            lsh_status = 1;
+        } else {
+            lsh_remove_alias(entry);
+        }
+    }
+    return 1;
+}
+
+// time command: (handled by lsh_execute_one()) runs the command and reports what it used
+// time on its own shows what the last command used, time -a on/off reports it after every command
+int lsh_time(char **args)
+{
+    if (args[1] == NULL) {
+        lsh_print_usage(&lsh_last_usage, "last command");
+    } else if (strcmp(args[1], "-a") == 0 && args[2] != NULL && args[3] == NULL
+               && (strcmp(args[2], "on") == 0 || strcmp(args[2], "off") == 0)) {
+        lsh_time_always = strcmp(args[2], "on") == 0;
+    } else {
+        fprintf(stderr, "lsh: time: usage: time [command] | time -a on|off\n");
+        lsh_status = 2;
+    }
+    return 1;
+}
+
+// lsh_split_line() hands out these exact strings for the operators and operators are recognised by address,
+// so a quoted or escaped "|" (ex: grep '|') stays an ordinary argument
+char lsh_op_pipe[] = "|";
+char lsh_op_background[] = "&";
+char lsh_op_sequence[] = ";";
+
+// returns 1 if the token is the pipe operator that lsh_split_line() produces for "|"
+int lsh_is_pipe(char *token)
+{
+    return token == lsh_op_pipe;
+}
+
+// returns 1 if the token is the background operator "&"
+int lsh_is_background(char *token)
+{
+    return token == lsh_op_background;
+}
+
+// returns 1 if the token is the ";" that separates commands run one after the other
+int lsh_is_sequence(char *token)
+{
+    return token == lsh_op_sequence;
+}
+
+/*
+  Redirections.
+ */
+// what a redirection does to its file descriptor
+#define LSH_REDIR_IN 0                                      // [n]<file      open file for reading (n = 0 by default)
+#define LSH_REDIR_OUT 1                                     // [n]>file      create/truncate file for writing (n = 1 by default)
+#define LSH_REDIR_APPEND 2                                  // [n]>>file     open file for writing at its end
+#define LSH_REDIR_DUP_IN 3                                  // [n]<&m        make n a copy of descriptor m
+#define LSH_REDIR_DUP_OUT 4                                 // [n]>&m        (ex: 2>&1)
+#define LSH_REDIR_KINDS 5
+// descriptors a redirection can name (a single digit in front of the operator)
+#define LSH_REDIR_FDS 10
+
+// like the other operators, redirections are tokens recognised by address: one entry per descriptor and kind
+struct lsh_redirect_op {
+    char text[5];                                           // what the token prints as (ex: "2>&"), must stay the first member
+    int fd;
+    int kind;
+};
+
+struct lsh_redirect_op lsh_redirect_ops[LSH_REDIR_FDS][LSH_REDIR_KINDS];
+
+// one redirection of a command, taken out of its argument list by lsh_take_redirects()
+struct lsh_redirect {
+    int fd;                                                 // descriptor of the command that gets replaced
+    int kind;
+    char *target;                                           // file name, or descriptor number for the DUP kinds
+    int src;                                                // what lsh_open_redirects() got for target: dup2(src, fd) applies it
+};
+
+// returns the token for a redirection of descriptor fd (-1 = the default descriptor for that kind)
+char *lsh_redirect_token(int fd, int kind)
+{
+    static char *ops[LSH_REDIR_KINDS] = { "<", ">", ">>", "<&", ">&" };
+    int default_fd = (kind == LSH_REDIR_IN || kind == LSH_REDIR_DUP_IN) ? STDIN_FILENO : STDOUT_FILENO;
+    struct lsh_redirect_op *op;
+
+    if (fd < 0) {
+        fd = default_fd;
+    }
+    op = &lsh_redirect_ops[fd][kind];
+    if (op->text[0] == '\0') {
+        // filled in the first time it is used, the default descriptor isn't written out (ex: ">" rather than "1>")
+        if (fd == default_fd) {
+            snprintf(op->text, sizeof(op->text), "%s", ops[kind]);
+        } else {
+            snprintf(op->text, sizeof(op->text), "%c%s", '0' + fd, ops[kind]);
+        }
+        op->fd = fd;
+        op->kind = kind;
+    }
+    return op->text;
+}
+
+// returns the redirection a token stands for, or NULL if it isn't one
+struct lsh_redirect_op *lsh_is_redirect(char *token)
+{
+    char *first = (char *) lsh_redirect_ops, *last = (char *) (lsh_redirect_ops + LSH_REDIR_FDS);
+
+    if (token >= first && token < last) {
+        return (struct lsh_redirect_op *) token;
+    }
+    return NULL;
+}
+
+// takes the redirections (and their targets) out of a command's argument list, which is compacted in place
+// (ex: sort < in -r > out  ->  sort -r) and returns them in the order they were written, in memory from the arena
+// *n is set to how many there are, or to -1 when a redirection has no target (the error has been reported)
+struct lsh_redirect *lsh_take_redirects(char **args, int *n)
+{
+    struct lsh_redirect_op *op;
+    struct lsh_redirect *redirects;
+    int i, count = 0, kept = 0;
+
+    for (i = 0; args[i] != NULL; i++) {
+        count += lsh_is_redirect(args[i]) != NULL;
+    }
+    redirects = lsh_arena_alloc(count * sizeof(struct lsh_redirect));
+
+    *n = 0;
+    for (i = 0; args[i] != NULL; i++) {
+        if ((op = lsh_is_redirect(args[i])) == NULL) {
+            args[kept++] = args[i];
+            continue;
+        }
+        if (args[i + 1] == NULL || lsh_is_redirect(args[i + 1])) {
+            fprintf(stderr, "lsh: syntax error near \"%s\"\n", args[i + 1] ? args[i + 1] : args[i]);
+            *n = -1;
+            return NULL;
+        }
+        redirects[*n].fd = op->fd;
+        redirects[*n].kind = op->kind;
+        redirects[*n].target = args[++i];
+        redirects[*n].src = -1;
+        (*n)++;
+    }
+    args[kept] = NULL;
+    return redirects;
+}
+
+// closes the files lsh_open_redirects() opened
+void lsh_close_redirects(struct lsh_redirect *redirects, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (redirects[i].kind <= LSH_REDIR_APPEND && redirects[i].src >= 0) {
+            close(redirects[i].src);
+            redirects[i].src = -1;
+        }
+    }
+}
+
+// opens the files named by the redirections, in the shell itself so a bad file name is reported as such (and not as the command failing)
+// they are close-on-exec: the command gets them through dup2(), which clears that flag on the copy
+// returns 0, or -1 when a file can't be opened (reported, and nothing is left open)
+int lsh_open_redirects(struct lsh_redirect *redirects, int n)
+{
+    static int flags[] = { O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND };
+    char *end;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (redirects[i].kind <= LSH_REDIR_APPEND) {
+            redirects[i].src = open(redirects[i].target, flags[redirects[i].kind] | O_CLOEXEC, 0666);
+            if (redirects[i].src < 0) {
+                fprintf(stderr, "lsh: %s: %s\n", redirects[i].target, strerror(errno));
+                lsh_close_redirects(redirects, i);
+                return -1;
+            }
+        } else {
+            redirects[i].src = (int) strtol(redirects[i].target, &end, 10);
+            if (end == redirects[i].target || *end != '\0' || redirects[i].src < 0) {
+                fprintf(stderr, "lsh: %s: ambiguous redirect\n", redirects[i].target);
+                redirects[i].src = -1;
+                lsh_close_redirects(redirects, i);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// points the descriptors at their redirection targets, left to right (so 2>&1 >out sends stderr where stdout was before)
+// returns 0, or -1 when a descriptor to copy isn't open (reported)
+int lsh_apply_redirects(struct lsh_redirect *redirects, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (dup2(redirects[i].src, redirects[i].fd) < 0) {
+            fprintf(stderr, "lsh: %s: %s\n", redirects[i].target, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// returns the built-in that runs the command args (the first word that isn't part of a redirection), or NULL for a program
+// cat only handles the plain case itself (files and -), given any option the real cat program runs instead
+struct lsh_builtin *lsh_find_builtin(char **args)
+{
+    struct lsh_builtin *builtin;
+    char *name = NULL;
+    int i, plain = 1;
+
+    for (i = 0; args[i] != NULL; i++) {
+        if (lsh_is_redirect(args[i])) {
+            i += args[i + 1] != NULL;
+        } else if (name == NULL) {
+            name = args[i];
+        } else if (args[i][0] == '-' && args[i][1] != '\0') {
+            plain = 0;
+        }
+    }
+    if (name == NULL || (builtin = lsh_lookup_builtin(name)) == NULL) {
+        return NULL;
+    }
+    if (builtin->func == &lsh_cat && !plain) {
+        return NULL;
+    }
+    return builtin;
+}
+
+// signals the shell ignores or handles itself, which every program it starts gets back with their default action
+// (ignored signals survive exec(), so the programs would otherwise ignore Ctrl-C too)
+void lsh_default_signals(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGCHLD);
+    if (lsh_interactive) {
+        sigaddset(set, SIGINT);
+        sigaddset(set, SIGQUIT);
+        sigaddset(set, SIGTSTP);
+        sigaddset(set, SIGTTIN);
+        sigaddset(set, SIGTTOU);
+    }
+}
+
+// starts a stage that runs a program: posix_spawn() instead of fork() + exec(), since fork() has to copy the page tables
+// of the whole shell (heap included) just for the child to throw them away in exec(). glibc's posix_spawn() uses
+// clone(CLONE_VM | CLONE_VFORK), so the child borrows the shell's memory until it has exec()ed
+// everything the child of lsh_fork_stage() does by hand is asked for here instead: the process group and signal setup
+// through the attributes, and hooking stdin/stdout up to the pipes through the file actions
+// returns the PID, or 0 when the program couldn't be started (the error has been reported)
+pid_t lsh_spawn_stage(char **args, pid_t pgid, int in_fd, int out_fd, int unused_fd,
+                      struct lsh_redirect *redirects, int nredirects, sigset_t *sigmask)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    char *path;
+    pid_t pid;
+    int err, i;
+
+    path = lsh_find_command(args[0]);
+    if (path == NULL) {
+        fprintf(stderr, "lsh: %s: command not found\n", args[0]);
+        return 0;
+    }
+
+    // join the job's process group (pgid 0 = first stage, which starts a new group named after its own PID)
+    // and unblock SIGCHLD, which the shell blocks while it launches a job
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    lsh_default_signals(&defaults);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, sigmask);
+
+    // make stdin/stdout refer to the pipe ends, then close the originals so that the only open write end of each pipe
+    // belongs to the stage writing into it (otherwise the reader never sees EOF)
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, in_fd);
+    }
+    if (out_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, out_fd);
+    }
+    // read end of the pipe this stage writes to (belongs to the next stage)
+    if (unused_fd >= 0) {
+        posix_spawn_file_actions_addclose(&actions, unused_fd);
+    }
+    // redirections come after the pipes, so 2>&1 | less sends stderr down the pipe too
+    for (i = 0; i < nredirects; i++) {
+        posix_spawn_file_actions_adddup2(&actions, redirects[i].src, redirects[i].fd);
+    }
+
+    err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    // the file remembered for the command is gone (ex: it was uninstalled): look it up in PATH again
+    if (err == ENOENT && path != args[0]) {
+        lsh_hash_forget(args[0]);
+        if ((path = lsh_find_command(args[0])) != NULL) {
+            err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (path == NULL) {
+        fprintf(stderr, "lsh: %s: command not found\n", args[0]);
+        return 0;
+    }
+    if (err != 0) {
+        fprintf(stderr, "lsh: %s: %s\n", args[0], strerror(err));
+        return 0;
+    }
+    return pid;
+}
+
+// starts a stage that runs a built-in (ex: help | grep cd, or help &): that needs the shell's own code, so it gets a real fork()
+// returns the PID, or -1 if fork() failed
+pid_t lsh_fork_stage(char **args, pid_t pgid, int in_fd, int out_fd, int unused_fd,
+                     struct lsh_redirect *redirects, int nredirects, sigset_t *sigmask)
+{
+    sigset_t defaults;
+    pid_t pid;
+    int sig;
+
+    // Creates a new process (child process) by duplicating current process (the parent/shell process)
+    // Will either return:
+    // 1. 0: we are in the child process
+    // 2. PID of child process (positive value): returns to parent process or caller after sucessfully creating child process
+    // 3. negative value: returns error
+    pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    // Child process
+    // join the job's process group, the parent does the same setpgid() call, whichever one runs first wins the race
+    setpgid(0, pgid);
+    lsh_default_signals(&defaults);
+    for (sig = 1; sig < NSIG; sig++) {
+        if (sigismember(&defaults, sig) == 1) {
+            signal(sig, SIG_DFL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, sigmask, NULL);
+
+    // dup2() makes stdin/stdout refer to the pipe ends (see lsh_spawn_stage())
+    if (in_fd != STDIN_FILENO) {
+        dup2(in_fd, STDIN_FILENO);
+        close(in_fd);
+    }
+    if (out_fd != STDOUT_FILENO) {
+        dup2(out_fd, STDOUT_FILENO);
+        close(out_fd);
+    }
+    if (unused_fd >= 0) {
+        close(unused_fd);
+    }
+    if (lsh_apply_redirects(redirects, nredirects) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // flush before exit so output buffered by printf() goes down the pipe
+    lsh_status = 0;
+    lsh_find_builtin(args)->func(args);
+    fflush(stdout);
+    exit(lsh_status);
+}
+
+// what parallel keeps for each command it has running: the output of a command is collected in two memory files and
+// copied out in one go once it is done, so the lines of commands running side by side don't get mixed up
+struct lsh_worker {
+    pid_t pid;                                              // 0 = free slot
+    int out;                                                // memfd_create() file holding its stdout
+    int err;                                                // and the one holding its stderr
+};
+
+// parallel's exit status is the number of commands that failed, up to this many (like GNU parallel)
+#define LSH_PARALLEL_MAX_FAILED 101
+
+// returns the next input for parallel: the next word after ::: or, without them, the next non-empty line of stdin
+char *lsh_parallel_input(char ***inputs)
+{
+    static char *line = NULL;
+    static size_t bufsize = 0;
+    ssize_t len;
+
+    if (*inputs != NULL) {
+        return **inputs != NULL ? *(*inputs)++ : NULL;
+    }
+    while ((len = getline(&line, &bufsize, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+// returns template (count words) with every {} replaced by input, or input added at the end if there is no {}
+// as one malloc()ed block (the argument list followed by the strings)
+char **lsh_parallel_command(char **template, int count, char *input)
+{
+    size_t size = (count + 2) * sizeof(char *), ilen = strlen(input);
+    char **argv, *out, *in, *brace;
+    int i, used = 0;
+
+    for (i = 0; i < count; i++) {
+        size += strlen(template[i]) + 1;
+        for (in = template[i]; (brace = strstr(in, "{}")) != NULL; in = brace + 2) {
+            size += ilen;
+            used = 1;
+        }
+    }
+    size += used ? 0 : ilen + 1;
+    if (!(argv = malloc(size))) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    out = (char *) (argv + count + 2);
+    for (i = 0; i < count; i++) {
+        argv[i] = out;
+        for (in = template[i]; (brace = strstr(in, "{}")) != NULL; in = brace + 2) {
+            out = stpcpy(mempcpy(out, in, brace - in), input);
+        }
+        out = stpcpy(out, in) + 1;
+    }
+    if (!used) {
+        argv[i++] = strcpy(out, input);
+    }
+    argv[i] = NULL;
+    return argv;
+}
+
+// copies the output a finished command of parallel collected to the real stdout/stderr and frees its slot
+void lsh_parallel_flush(struct lsh_worker *worker)
+{
+    lseek(worker->out, 0, SEEK_SET);
+    lseek(worker->err, 0, SEEK_SET);
+    lsh_copy_fd(worker->out, STDOUT_FILENO);
+    lsh_copy_fd(worker->err, STDERR_FILENO);
+    close(worker->out);
+    close(worker->err);
+    worker->pid = 0;
+}
+
+// parallel [-j N] command [args...] ::: input...: runs command args... input for every input, N of them at a time
+// (default: one per CPU), starting the next one as soon as one exits. Without ::: the inputs are the lines of stdin
+// (ex: ls *.log | parallel -j 4 gzip), and {} in the arguments stands for the input (ex: parallel cp {} {}.bak ::: *.c)
+// it always runs as a job of its own (see lsh_execute_one()) and the commands join its process group, so Ctrl-C, Ctrl-Z,
+// fg and time handle them all together; the output of every command comes out in one piece once it is done
+int lsh_parallel(char **args)
+{
+    struct lsh_worker *workers;
+    struct lsh_redirect err_redirect = { STDERR_FILENO, LSH_REDIR_OUT, "parallel", -1 };
+    char **template, **inputs = NULL, **argv, *input;
+    int count, slots, running = 0, failed = 0, in_fd = STDIN_FILENO, status, i;
+    sigset_t mask;
+    pid_t pid;
+
+    i = 1;
+    slots = sysconf(_SC_NPROCESSORS_ONLN);
+    if (args[i] != NULL && strncmp(args[i], "-j", 2) == 0) {
+        slots = args[i][2] != '\0' ? atoi(args[i] + 2) : args[i + 1] != NULL ? atoi(args[++i]) : 0;
+        i++;
+    }
+    template = args + i;
+    for (count = 0; template[count] != NULL && strcmp(template[count], ":::") != 0; count++) {
+    }
+    if (count == 0 || slots < 1) {
+        fprintf(stderr, "lsh: parallel: usage: parallel [-j N] command [args...] [::: input...]\n");
+        lsh_status = 2;
+        return 1;
+    }
+    if (template[count] != NULL) {
+        inputs = template + count + 1;
+    } else if ((in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+        // the inputs come from stdin, so the commands mustn't read it
+        in_fd = STDIN_FILENO;
+    }
+
+    if (!(workers = calloc(slots, sizeof(struct lsh_worker)))) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+
+    for (;;) {
+        // fill every free slot
+        while (running < slots && (input = lsh_parallel_input(&inputs)) != NULL) {
+            for (i = 0; workers[i].pid != 0; i++) {
+            }
+            workers[i].out = memfd_create("lsh-parallel-out", MFD_CLOEXEC);
+            workers[i].err = memfd_create("lsh-parallel-err", MFD_CLOEXEC);
+            if (workers[i].out < 0 || workers[i].err < 0) {
+                fprintf(stderr, "lsh: parallel: %s\n", strerror(errno));
+                close(workers[i].out);
+                close(workers[i].err);
+                failed++;
+                break;
+            }
+            err_redirect.src = workers[i].err;
+            argv = lsh_parallel_command(template, count, input);
+            pid = lsh_spawn_stage(argv, getpgrp(), in_fd, workers[i].out, -1, &err_redirect, 1, &mask);
+            free(argv);
+            if (pid <= 0) {
+                close(workers[i].out);
+                close(workers[i].err);
+                failed++;
+                continue;
+            }
+            workers[i].pid = pid;
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        // wait for any of them (SIGCHLD has its default action in here, so nothing else collects them)
+        if ((pid = waitpid(-1, &status, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (i = 0; i < slots && workers[i].pid != pid; i++) {
+        }
+        if (i == slots) {
+            continue;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+        lsh_parallel_flush(&workers[i]);
+        running--;
+    }
+
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    free(workers);
+    lsh_status = failed < LSH_PARALLEL_MAX_FAILED ? failed : LSH_PARALLEL_MAX_FAILED;
+    return 1;
+}
+
+// takes list of arguments (token array) -> forks the process -> saves return value
+// shells start processes (programs in execution that have a unique PID #), which the kernel controls/manages. Very interesting how it works.
+// A process is made up of an executable program, it's data (with program ptr) and stack (with stack ptr), CPU registers which can be shared between parent and child processes, etc. 
+// the shell itself is a process that creates child processes to execute commands and loops indefinitely, also interesting how system calls work to manipulate processes for shell functionality
+// args may hold a whole pipeline (ex: ls | sort | head): every stage is forked right away and connected to the next one with pipe(),
+// so data streams between them through kernel buffers while they all run at the same time. The stages make up one job:
+// a foreground job gets the terminal and the shell waits for it, a background one (cmd &) is left running and the prompt comes straight back
+int lsh_launch(char **args, int background)
+{
+    struct lsh_job *job;                                    // job table entry for the pipeline
+    pid_t pid = 0;                                          // stores processID (PID) of the stage just started
+    int stages = 1;                                         // number of commands in the pipeline
+    int in_fd = STDIN_FILENO, fd[2];                        // where the next stage reads from, the pipe between it and the one after
+    char **stage = args, **next;                            // first argument of the stage currently being launched, and of the one after it
+    struct lsh_redirect *redirects;                         // redirections of the stage
+    int nredirects;
+    sigset_t old;                                           // signal mask from before SIGCHLD got blocked
+    int i;
+
+    // a pipe needs a command on both sides (ex: "ls |" or "| sort" or "ls | | sort")
+    for (i = 0; args[i] != NULL; i++) {
+        if (lsh_is_pipe(args[i])) {
+            if (i == 0 || lsh_is_pipe(args[i - 1]) || args[i + 1] == NULL) {
+                fprintf(stderr, "lsh: syntax error near \"|\"\n");
+                lsh_status = 2;
+                return 1;
+            }
+            stages++;
+        }
+    }
+
+    // the SIGCHLD handler must not run before the job and its PIDs are in the table, or it would drop their exit status
+    lsh_block_sigchld(&old);
+    job = lsh_new_job(args, stages, background);
+    if (job == NULL) {
+        lsh_status = 1;
+        lsh_restore_sigmask(&old);
+        return 1;
+    }
+
+    // anything still sitting in the stdout buffer (ex: the prompt) would be copied into each child and printed again by a built-in stage
+    fflush(stdout);
+
+    // cut the token array into one null-terminated argument list per stage by replacing each "|" with NULL
+    for (i = 0; args[i] != NULL; i++) {
+        if (lsh_is_pipe(args[i])) {
+            args[i] = NULL;
+        }
+    }
+
+    for (i = 0; i < stages; i++) {
+        // every stage except the last one writes into a fresh pipe that the next stage reads from
+        fd[0] = -1;
+        fd[1] = STDOUT_FILENO;
+        if (i < stages - 1 && pipe(fd) == -1) {
+            perror("lsh");
+            break;
+        }
+
+        // the argument list of the next stage starts right after the NULL that replaced "|"
+        // (found before the redirections get taken out, which moves the NULL ending this one)
+        for (next = stage; *next != NULL; next++) {
+        }
+        next++;
+
+        // time in front of a later stage (ex: make | time tail) reports on the pipeline as a whole, like one in front of it all
+        if (stage[0] != NULL && strcmp(stage[0], "time") == 0 && stage[1] != NULL && stage[1][0] != '-') {
+            stage++;
+            job->timed = 1;
+        }
+
+        // built-ins need a copy of the shell, programs get spawned (a stage whose program can't be found or whose
+        // redirection fails is left out, the stages around it just see EOF/EPIPE like bash)
+        // a stage that is only redirections (ex: > file) creates/opens its files and runs nothing
+        // (the status a stage that isn't started leaves behind for $?, if it's the last one)
+        redirects = lsh_take_redirects(stage, &nredirects);
+        if (nredirects < 0 || lsh_open_redirects(redirects, nredirects) < 0) {
+            pid = 0;
+            job->status = nredirects < 0 ? 2 : 1;
+        } else if (stage[0] == NULL) {
+            pid = 0;
+            job->status = 0;
+        } else if (lsh_find_builtin(stage) != NULL) {
+            pid = lsh_fork_stage(stage, job->pgid, in_fd, fd[1], fd[0], redirects, nredirects, &old);
+        } else if ((pid = lsh_spawn_stage(stage, job->pgid, in_fd, fd[1], fd[0], redirects, nredirects, &old)) == 0) {
+            job->status = 127;
+        }
+        if (pid != 0) {
+            job->status = pid < 0 ? 1 : -1;
+        }
+        if (nredirects > 0) {
+            lsh_close_redirects(redirects, nredirects);
+        }
+        if (pid < 0) {
+            // Error forking (the fork() call failed)
+            // the stages already started are still waited for below, they see EOF/EPIPE once we close our pipe ends
+            perror("lsh");
+        } else if (pid > 0) {
+            // Parent process
+            // first stage names the process group, the rest join it (the parent makes the setpgid() call too, in case it runs before the child does)
+            if (job->pgid == 0) {
+                job->pgid = pid;
+                // give the terminal to a foreground job so it (and not the shell) gets keyboard input and Ctrl-C/Ctrl-Z
+                if (lsh_interactive && !background) {
+                    tcsetpgrp(STDIN_FILENO, job->pgid);
+                }
+            }
+            setpgid(pid, job->pgid);
+            job->procs[job->nprocs].pid = pid;
+            job->procs[job->nprocs].state = LSH_RUNNING;
+            job->nprocs++;
+        }
+
+        // the shell keeps none of the pipe ends: the read end now belongs to the next stage, the write end to this one
+        if (in_fd != STDIN_FILENO) {
+            close(in_fd);
+        }
+        if (fd[1] != STDOUT_FILENO) {
+            close(fd[1]);
+        }
+        in_fd = fd[0];
+        if (pid < 0) {
+            break;
+        }
+
+        stage = next;
+    }
+    // read end of a pipe left over when launching stopped early
+    if (in_fd != STDIN_FILENO && in_fd >= 0) {
+        close(in_fd);
+    }
+
+    if (job->nprocs == 0) {
+        // not a single stage could be started
+        lsh_status = job->status >= 0 ? job->status : 1;
+        lsh_free_job(job);
+    } else if (background) {
+        // report the job number and process group like bash does, then return to the prompt at once
+        // the SIGCHLD handler notes when the job finishes and lsh_notify_jobs() reports it before a later prompt
+        if (lsh_interactive) {
+            printf("[%d] %d\n", job->id, (int) job->pgid);
+        }
+        lsh_status = 0;
+        lsh_last_background = job->pgid;
+    } else {
+        // Parent process
+        // wait for every process in the job to finish (or to be stopped with Ctrl-Z)
+        // useful so that shell does not execute next command until after the whole pipeline finishes executing
+        lsh_foreground_job(job, 0, &old);
+    }
+    lsh_restore_sigmask(&old);
+
+    // indicates that shell should continue running
+    return 1;
+}
+
+// calls a built-in that runs in the shell, measuring it with getrusage() like wait4() measures a child
+// time in front of a built-in also shows the heap of the shell (mallinfo2() answers for the preloaded allocator
+// when there is one, glibc otherwise), which is the only allocator a built-in uses
+int lsh_call_builtin(char **args, struct lsh_builtin *builtin)
+{
+    struct rusage before, after;
+    struct lsh_usage usage;
+    struct mallinfo2 heap_before, heap_after;
+    struct timespec start;
+    int reports = lsh_usage_reports, timed = lsh_timed || lsh_time_always, status;
+
+    // time on its own shows the last command's numbers, so it mustn't replace them with its own
+    lsh_status = 0;
+    if (builtin->func == lsh_time) {
+        return builtin->func(args);
+    }
+    if (timed) {
+        heap_before = mallinfo2();
+    }
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    status = builtin->func(args);
+
+    getrusage(RUSAGE_SELF, &after);
+    if (lsh_usage_reports != reports) {
+        return status;
+    }
+    memset(&usage, 0, sizeof(usage));
+    usage.real = lsh_elapsed(&start);
+    usage.user = lsh_seconds(&after.ru_utime) - lsh_seconds(&before.ru_utime);
+    usage.sys = lsh_seconds(&after.ru_stime) - lsh_seconds(&before.ru_stime);
+    usage.maxrss = after.ru_maxrss;                         // the shell's high-water mark, it can't be split up
+    usage.minflt = after.ru_minflt - before.ru_minflt;
+    usage.majflt = after.ru_majflt - before.ru_majflt;
+    usage.nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    usage.nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    lsh_report_usage(&usage, args[0], lsh_timed);
+    if (timed) {
+        heap_after = mallinfo2();
+        fprintf(stderr, "%s: heap %zu KB in use (%+ld KB), %zu KB mapped\n", args[0],
+                (heap_after.uordblks + heap_after.hblkhd) / 1024,
+                ((long) (heap_after.uordblks + heap_after.hblkhd) - (long) (heap_before.uordblks + heap_before.hblkhd)) / 1024,
+                (heap_after.arena + heap_after.hblkhd) / 1024);
+    }
+    return status;
+}
+
+// runs a built-in in the shell itself (so cd or exit affect the shell), with its redirections applied around it:
+// the descriptors are saved, pointed at the files for the built-in (so printf() in lsh_help() writes to them), and put back afterwards
+int lsh_run_builtin(char **args, struct lsh_builtin *builtin)
+{
+    struct lsh_redirect *redirects;
+    int n, i, *saved, status = 1;
+
+    redirects = lsh_take_redirects(args, &n);
+    if (n < 0 || lsh_open_redirects(redirects, n) < 0) {
+        lsh_status = n < 0 ? 2 : 1;
+        return 1;
+    }
+    if (n == 0) {
+        return lsh_call_builtin(args, builtin);
+    }
+
+    // the copies of the shell's own descriptors go above the ones a user is likely to name (and don't survive exec())
+    fflush(stdout);
+    saved = lsh_arena_alloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        saved[i] = fcntl(redirects[i].fd, F_DUPFD_CLOEXEC, LSH_REDIR_FDS);
+    }
+    if (lsh_apply_redirects(redirects, n) == 0) {
+        status = lsh_call_builtin(args, builtin);
+    } else {
+        lsh_status = 1;
+    }
+    // what the built-in printed has to reach the file before stdout goes back to where it was
+    fflush(stdout);
+    fflush(stderr);
+    for (i = n - 1; i >= 0; i--) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], redirects[i].fd);
+            close(saved[i]);
+        } else {
+            close(redirects[i].fd);
+        }
+    }
+    lsh_close_redirects(redirects, n);
+    return status;
+}
+
+// lsh_split_line() leaves one of these in place of a "$" that starts a variable (outside single quotes, not after a backslash),
+// since a line is split before the commands in front of it have run, and $? has to be what the last one left behind
+#define LSH_VAR_MARK '\001'
+#define LSH_VAR_MARK_QUOTED '\002'                          // the same inside double quotes ("$X" stays one argument even if it is empty)
+#define LSH_VAR_MARKS "\001\002"
+
+// returns the value of the shell variable called name (len characters), or NULL if there is no such variable
+// buf (32 bytes) holds the value of those that are numbers
+char *lsh_shell_var(char *name, size_t len, char *buf)
+{
+    static const struct {
+        const char *name;
+        int kind;                                           // 0 = seconds, 1 = counter
+        size_t offset;
+    } vars[] = {
+        { "TIME_REAL", 0, offsetof(struct lsh_usage, real) },
+        { "TIME_USER", 0, offsetof(struct lsh_usage, user) },
+        { "TIME_SYS", 0, offsetof(struct lsh_usage, sys) },
+        { "TIME_MAXRSS", 1, offsetof(struct lsh_usage, maxrss) },
+        { "TIME_MINFLT", 1, offsetof(struct lsh_usage, minflt) },
+        { "TIME_MAJFLT", 1, offsetof(struct lsh_usage, majflt) },
+        { "TIME_NVCSW", 1, offsetof(struct lsh_usage, nvcsw) },
+        { "TIME_NIVCSW", 1, offsetof(struct lsh_usage, nivcsw) },
+    };
+    char *usage = (char *) &lsh_last_usage, saved;
+    size_t i;
+
+    if (len == 1 && (*name == '?' || *name == '$' || *name == '!')) {
+        snprintf(buf, 32, "%d", *name == '?' ? lsh_status : *name == '$' ? (int) getpid() : (int) lsh_last_background);
+        return buf;
+    }
+    for (i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        if (strlen(vars[i].name) == len && strncmp(vars[i].name, name, len) == 0) {
+            if (vars[i].kind == 0) {
+                snprintf(buf, 32, "%.3f", *(double *) (usage + vars[i].offset));
+            } else {
+                snprintf(buf, 32, "%ld", *(long *) (usage + vars[i].offset));
+            }
+            return buf;
+        }
+    }
+    // anything else comes from the environment (getenv() needs the name on its own)
+    saved = name[len];
+    name[len] = '\0';
+    buf = getenv(name);
+    name[len] = saved;
+    return buf;
+}
+
+// the variable whose name starts at *in: $?, $$, $!, $NAME or ${NAME}. Moves *in past it and returns its value ("" if it isn't set),
+// or returns NULL (a literal "$") if no name follows
+char *lsh_var_value(char **in, char *buf)
+{
+    char *name = *in, *end, *value;
+    int brace = *name == '{';
+
+    if (*name == LSH_VAR_MARK || *name == LSH_VAR_MARK_QUOTED) {
+        // the second "$" of $$ got marked too
+        *in = name + 1;
+        return lsh_shell_var("$", 1, buf);
+    }
+    if (*name == '?' || *name == '$' || *name == '!') {
+        end = name + 1;
+    } else {
+        name += brace;
+        for (end = name; isalnum((unsigned char) *end) || *end == '_'; end++) {
+        }
+        if (end == name || isdigit((unsigned char) *name) || (brace && *end != '}')) {
+            return NULL;
+        }
+    }
+    value = lsh_shell_var(name, end - name, buf);
+    *in = end + brace;
+    return value ? value : "";
+}
+
+// replaces the variables in the arguments of one command with their values (the new strings come from the arena)
+// an unquoted variable that is the whole argument and comes out empty leaves no argument behind, like in other shells
+void lsh_expand_vars(char **args)
+{
+    char buf[32], *in, *out, *value, *expanded;
+    size_t len;
+    int i, j;
+
+    for (i = j = 0; args[i] != NULL; i++) {
+        if (strpbrk(args[i], LSH_VAR_MARKS) == NULL) {
+            args[j++] = args[i];
+            continue;
+        }
+        // once to size the result, once to fill it in
+        len = 0;
+        for (in = args[i]; *in != '\0'; ) {
+            if (*in == LSH_VAR_MARK || *in == LSH_VAR_MARK_QUOTED) {
+                in++;
+                value = lsh_var_value(&in, buf);
+                len += value ? strlen(value) : 1;
+            } else {
+                in++;
+                len++;
+            }
+        }
+        out = expanded = lsh_arena_alloc(len + 1);
+        for (in = args[i]; *in != '\0'; ) {
+            if (*in == LSH_VAR_MARK || *in == LSH_VAR_MARK_QUOTED) {
+                in++;
+                value = lsh_var_value(&in, buf);
+                out = value ? stpcpy(out, value) : stpcpy(out, "$");
+            } else {
+                *out++ = *in++;
+            }
+        }
+        *out = '\0';
+        if (*expanded == '\0' && strchr(args[i], LSH_VAR_MARK_QUOTED) == NULL) {
+            continue;
+        }
+        args[j++] = expanded;
+    }
+    args[j] = NULL;
+}
+
+// runs one command (or pipeline) that is not followed by "&", except for the background flag
+// time in front of it (ex: time make | tail) reports what the whole command used once it is done
+int lsh_execute_one(char **args, int background)
+{
+    struct lsh_builtin *builtin;
+    int i, status;
+
+    lsh_expand_vars(args);
+    if (args[0] != NULL && strcmp(args[0], "time") == 0 && args[1] != NULL && args[1][0] != '-') {
+        lsh_timed = 1;
+        status = lsh_execute_one(args + 1, background);
+        lsh_timed = 0;
+        return status;
+    }
+    if (args[0] == NULL) {
+        return 1;
+    }
+
+    // a pipeline (ex: ls | wc -l) or a background job always goes to lsh_launch(), even if it runs a built-in
+    for (i = 0; args[i] != NULL && !background; i++) {
+        if (lsh_is_pipe(args[i])) {
+            break;
+        }
+    }
+
+    // look the command entered in by the user (usually at args[0]) up in the name table
+    // if it is a built-in then the corresponding function pointer is called with arguments array as parameter for function
+    // example: user enters "cd" -> builtin->func points to lsh_cd -> lsh_cd(args) is called/executed
+    // (except parallel, which is started like a program: its commands need a process group to join, and
+    // cat at an interactive prompt, which can block on a terminal or a FIFO for good: as a job of its own it gets
+    // Ctrl-C and Ctrl-Z back, which the shell itself ignores)
+    if (!background && args[i] == NULL && (builtin = lsh_find_builtin(args)) != NULL && builtin->func != &lsh_parallel &&
+        !(builtin->func == &lsh_cat && lsh_interactive)) {
+        return lsh_run_builtin(args, builtin);
+    }
+
+    // if the command user enters is not one built into the shell, it calls lsh_launch() to launch process
+    return lsh_launch(args, background);
+}
+
+// replaces the first word of every command on the line (at the start and after |, & and ;) that is an alias with what it stands for
+// the expansion is split like a command line of its own and may start with an alias too, though not one already expanded
+// at that spot (so alias ls='ls -F' doesn't loop); returns the new token array (in the arena), or args if nothing changed
+char **lsh_expand_aliases(char **args)
+{
+    struct lsh_name *entry, *seen[LSH_ALIAS_DEPTH];
+    char **expansion, **result, *value;
+    int i, j, n, count, depth;
+
+    for (i = 0; args[i] != NULL; i++) {
+        if (i > 0 && !lsh_is_pipe(args[i - 1]) && !lsh_is_background(args[i - 1]) && !lsh_is_sequence(args[i - 1])) {
+            continue;
+        }
+        for (depth = 0; depth < LSH_ALIAS_DEPTH && args[i] != NULL; depth++) {
+            entry = lsh_lookup_name(args[i], 0);
+            if (entry == NULL || entry->alias == NULL) {
+                break;
+            }
+            for (j = 0; j < depth && seen[j] != entry; j++) {
+            }
+            if (j < depth) {
+                break;
+            }
+            seen[depth] = entry;
+
+            // the tokenizer writes into what it splits, so it gets a copy of the value
+            value = lsh_arena_alloc(strlen(entry->alias) + 1);
+            strcpy(value, entry->alias);
+            if ((expansion = lsh_split_line(value)) == NULL) {
+                break;
+            }
+            for (n = 0; expansion[n] != NULL; n++) {
+            }
+            for (count = i; args[count] != NULL; count++) {
+            }
+
+            // tokens before the alias, the expansion, then the rest of the line (with its NULL)
+            result = lsh_arena_alloc((count + n) * sizeof(char *));
+            memcpy(result, args, i * sizeof(char *));
+            memcpy(result + i, expansion, n * sizeof(char *));
+            memcpy(result + i + n, args + i + 1, (count - i) * sizeof(char *));
+            args = result;
+        }
+        // an alias for nothing at the end of the line
+        if (args[i] == NULL) {
+            break;
+        }
+    }
+    return args;
+}
+
+// execute the given arguments (char** args == char** tokens)
+// "&" ends a command that runs in the background, so one line can start several jobs (ex: make a & make b & wait-for-it)
+// ";" ends a command that runs in the foreground before the rest of the line (ex: cd /tmp; ls)
+int lsh_execute(char **args)
+{
+    char **command = args;                                  // first argument of the command being started
+    int i, background, status = 1;
+
+    // if first argument is empty (user enters whitespace and/or hits enter key)
+    if (args[0] == NULL) {
+        // An empty command was entered. 
+        return 1;
+    }
+
+    args = command = lsh_expand_aliases(args);
+    for (i = 0; args[i] != NULL; i++) {
+        if (lsh_is_background(args[i]) || lsh_is_sequence(args[i])) {
+            // "&" and ";" need a command in front of them (ex: "& ls" or "ls ; ;")
+            if (command == &args[i]) {
+                fprintf(stderr, "lsh: syntax error near \"%s\"\n", args[i]);
+                lsh_status = 2;
+                return 1;
+            }
+            background = lsh_is_background(args[i]);
+            args[i] = NULL;
+            status = lsh_execute_one(command, background);
+            command = &args[i + 1];
+            // exit in the middle of the line
+            if (status == 0) {
+                return 0;
+            }
+        }
+    }
+
+    // whatever follows the last "&" or ";" runs in the foreground
+    if (*command != NULL) {
+        status = lsh_execute_one(command, 0);
+    }
+    return status;
+}
+
+/*
+// same purpose as function below, but without using getline() (a line input function)
+// initial size of buffer used to store user input (1 kilobyte or 1024 bytes)
+#define LSH_RL_BUFSIZE 1024
+// reads a line of input from the user and dynamically resizes the buffer if necessary (if input exceeds initial size)
+char *lsh_read_line(void)
+{
+ 
+    int bufsize = LSH_RL_BUFSIZE;                           // buffer size (assigned to variable since it can change)
+    int position = 0;                                       // current position in buffer
+    char *buffer = malloc(sizeof(char) * bufsize);          // allocate memory for buffer                          
+    int c;                                                  // stores char from input as ASCII value (an int)
+
+    // if memory allocation fails, error msg printed to stderr and exit program with a failure status
+    if (!buffer) {
+        fprintf(stderr, "lsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        // Read a character from standard input (the terminal)
+        c = getchar();
+
+        // If we hit EOF or a newline, replace it with a null character and return.
+        // else buffer at that current position is assigned the character value 
+        if (c == EOF || c == '\n') {
+            buffer[position] = '\0';
+            return buffer;
+        } else {
+            buffer[position] = c;
+        }
+        position++;                                         // go to next position in buffer by incrementing
+
+        // If we have exceeded the buffer, reallocate.
+        if (position >= bufsize) {
+            bufsize += LSH_RL_BUFSIZE;                      // increase buffer size by 1024 bytes
+            buffer = realloc(buffer, bufsize);              // use this new buffer size as parameter in realloc()
+            // always safe to include this to prevent any errors if memory cannot be allocated
+            if (!buffer) {
+                fprintf(stderr, "lsh: allocation error\n");
+                exit(EXIT_FAILURE);                         // exit program with a failure status
+            }
+        }
+    }
+} */
+
+// for reading a line of input from user using getline()
+// the buffer is kept from one call to the next, getline() only grows it when a line is longer than every line before it
+char *lsh_read_line(void)
+{
+    static char *line = NULL;                               // where to store the users input line, first initialize to NULL
+    static size_t bufsize = 0;                              // have getline allocate a buffer for us (the first time)
+  
+    if (getline(&line, &bufsize, stdin) == -1){             // when getline() == -1, either error has occured or end of input (EOF) has been reached
+        if (feof(stdin)) {       // checks if EOF was reached 
+            exit(lsh_status);    // We recieved an EOF (line has been successfully stored), leave with the status of the last command
+        } else  {
+            perror("readline");  // if there was an error
+            exit(EXIT_FAILURE);  // exit program with failure status
+        }
+    }
+  
+    return line;                                            // return the line
+}
+
+// for parsing through the stored user input line, and separating it into a list of arguments (token array)
+// macro defining what delimiters are valid for splitting up the input line
+#define LSH_TOK_DELIM " \t\r\n\a"
+// characters that start a token of their own even without whitespace around them (ex: ls|wc>out& -> "ls" "|" "wc" ">" "out" "&")
+#define LSH_TOK_OPERATORS "|&;<>"
+// characters a backslash keeps their literal meaning for inside double quotes (anywhere else a backslash escapes any character)
+#define LSH_TOK_DQ_ESCAPES "\"\\$`\n"
+// returns the token for the operator that starts with c, *in points right after c and is moved past the rest of the operator
+// (ex: the ">&" of 2>&1), fd is the descriptor written in front of a redirection or -1
+char *lsh_operator(char c, char **in, int fd)
+{
+    if (c == '<' || c == '>') {
+        if (**in == '&') {
+            (*in)++;
+            return lsh_redirect_token(fd, c == '<' ? LSH_REDIR_DUP_IN : LSH_REDIR_DUP_OUT);
+        }
+        if (c == '>' && **in == '>') {
+            (*in)++;
+            return lsh_redirect_token(fd, LSH_REDIR_APPEND);
+        }
+        return lsh_redirect_token(fd, c == '<' ? LSH_REDIR_IN : LSH_REDIR_OUT);
+    }
+    return c == '|' ? lsh_op_pipe : c == '&' ? lsh_op_background : lsh_op_sequence;
+}
+
+// returns the token array (from the arena, null-terminated), words are unquoted in place inside line
+// a line with an unterminated quote is reported and gives back NULL
+char **lsh_split_line(char *line)
+{
+    // each token takes at least one character of the line, so this many slots (+1 for the NULL) is always enough
+    char **tokens = lsh_arena_alloc((strlen(line) + 1) * sizeof(char *));
+    int position = 0;                                       // current location in tokens array (the tokens array is where we will be storing our args)
+    char *in = line;                                        // next character of the line to look at
+    char *out;                                              // where the next character of the current word goes
+    char quote;                                             // quote we are inside of (' or "), or 0
+    int quoted;                                             // the current word had quotes or backslashes in it
+    int fd;                                                 // descriptor written in front of a redirection
+    char c;
+
+    // one pass over the line: delimiters are skipped, operators become tokens of their own, comments end the line, and everything else
+    // is a word whose quotes and backslashes are removed as it is copied over itself
+    // (that works in place since the unquoted word is never longer than what was typed)
+    while ((c = *in) != '\0') {
+        if (strchr(LSH_TOK_DELIM, c) != NULL) {
+            in++;
+            continue;
+        }
+        if (strchr(LSH_TOK_OPERATORS, c) != NULL) {
+            in++;
+            tokens[position++] = lsh_operator(c, &in, -1);
+            continue;
+        }
+        // a "#" where a word would start comments out the rest of the line (ex: a #! line at the top of a script)
+        if (c == '#') {
+            break;
+        }
+
+        // a word runs until the next delimiter or operator outside of quotes (ex: a"b c"'|'d is the one word: ab c|d)
+        tokens[position++] = out = in;
+        quote = quoted = 0;
+        while ((c = *in) != '\0' && (quote || strchr(LSH_TOK_DELIM LSH_TOK_OPERATORS, c) == NULL)) {
+            in++;
+            quoted |= c == '\'' || c == '"' || c == '\\';
+            if (quote == '\'') {
+                // nothing is special inside single quotes except the closing quote
+                if (c == '\'') {
+                    quote = 0;
+                } else {
+                    *out++ = c;
+                }
+            } else if (c == '\\' && (quote == 0 || strchr(LSH_TOK_DQ_ESCAPES, *in) != NULL)) {
+                // backslash: the next character is taken literally, a backslash-newline disappears altogether
+                if (*in != '\0' && *in != '\n') {
+                    *out++ = *in;
+                }
+                if (*in != '\0') {
+                    in++;
+                }
+            } else if (c == quote) {
+                quote = 0;
+            } else if (quote == 0 && (c == '\'' || c == '"')) {
+                quote = c;
+            } else if (c == '$') {
+                // the value isn't known yet (see lsh_expand_vars())
+                *out++ = quote ? LSH_VAR_MARK_QUOTED : LSH_VAR_MARK;
+            } else {
+                *out++ = c;
+            }
+        }
+        if (quote) {
+            fprintf(stderr, "lsh: unexpected EOF while looking for matching `%c'\n", quote);
+            lsh_status = 2;
+            return NULL;
+        }
+
+        // the '\0' ending the word may land on the delimiter or operator right after it (c still holds that one)
+        *out = '\0';
+        if (c == '\0') {
+            break;
+        }
+        in++;
+        if (strchr(LSH_TOK_OPERATORS, c) != NULL) {
+            // a lone digit right in front of a redirection is the descriptor it redirects (ex: 2>err), not an argument
+            if ((c == '<' || c == '>') && !quoted && out - tokens[position - 1] == 1 && isdigit((unsigned char) *tokens[position - 1])) {
+                fd = *tokens[--position] - '0';
+                tokens[position++] = lsh_operator(c, &in, fd);
+            } else {
+                tokens[position++] = lsh_operator(c, &in, -1);
+            }
+        }
+    }
+    // Null-terminate array (many functions that process string arrays expect it to be null-terminated)
+    tokens[position] = NULL;
+    // return the token array
+    return tokens;
+}
+
+// loop gets input from the user and executes it
+void lsh_loop(void)
+{
+    char *line;                                         // pointer to string holding user input
+    char **args;                                        // pointer to array of strings (arguments) from splitting the input line from user
+    int status;                                         // indicates whether shell should keep running or not
+
+    do {
+        lsh_notify_jobs();                              // 0. report background jobs that finished in the meantime
+        if (lsh_interactive) {
+            printf("> ");                               // 1. print prompt (only for someone typing at a terminal, not when stdin is a pipe or file)
+        }
+        line = lsh_read_line();                         // 2. read the line from user (we call a function for it)
+        args = lsh_split_line(line);                    // 3. split the line into args (we call a function for it), NULL = syntax error
+        status = args ? lsh_execute(args) : 1;          // 4. Execute those args, also determines whether or not shell should keep on running (we call a function for it)
+
+        // nothing to free: the line buffer is reused by the next lsh_read_line() and the arguments live in the arena
+        lsh_arena_reset();
+    } while (status);
+}
+
+/*
+  Scripts and -c.
+ */
+// runs all of text (a -c string or a whole script file, len bytes, which get '\0's written into them) one line at a time
+// the whole text is parsed before the first command runs, so running a script is just executing ready token arrays,
+// and a script with a syntax error in it is rejected without running half of it
+// returns the exit status for main()
+int lsh_run_text(char *text, size_t len)
+{
+    char *end = text + len, *line, *nl;
+    char ***commands;                                       // token array of each line, from the arena
+    size_t lines = 1, n = 0, i;
+    int errors = 0;
+
+    for (line = text; (nl = memchr(line, '\n', end - line)) != NULL; line = nl + 1) {
+        lines++;
+    }
+    commands = lsh_arena_alloc(lines * sizeof(char **));
+
+    for (line = text; line < end; line = nl + 1) {
+        nl = memchr(line, '\n', end - line);
+        if (nl != NULL) {
+            *nl = '\0';
+        } else {
+            // the last line has no newline after it, and the byte after the input may not be ours to write: copy the line
+            nl = lsh_arena_alloc(end - line + 1);
+            memcpy(nl, line, end - line);
+            nl[end - line] = '\0';
+            line = nl;
+            nl = end;
+        }
+        if ((commands[n] = lsh_split_line(line)) == NULL) {
+            errors++;
+        }
+        n++;
+    }
+    if (errors) {
+        return lsh_status;
+    }
+
+    // the arena holds the whole script, so it is only emptied once everything has run
+    for (i = 0; i < n; i++) {
+        lsh_notify_jobs();
+        if (!lsh_execute(commands[i])) {
+            break;
+        }
+    }
+    lsh_arena_reset();
+    return lsh_status;
+}
+
+// runs the script file at path (main script.lsh)
+// a regular file is mapped into memory (MAP_PRIVATE, so the '\0's lsh_split_line() writes into it stay ours), anything else
+// (ex: /dev/stdin or a named pipe) is read in with large read()s. Either way it's a handful of system calls for the whole file
+int lsh_run_file(char *path)
+{
+    struct stat st;
+    char *text = MAP_FAILED, *buf;
+    size_t len = 0, size = 0;
+    ssize_t got;
+    int fd, status, mapped = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "lsh: %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        len = st.st_size;
+        text = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED) {
+            madvise(text, len, MADV_SEQUENTIAL);
+            mapped = 1;
+        }
+    }
+    if (text == MAP_FAILED) {
+        // st_blksize is a good guess for how much one read() should ask for
+        text = NULL;
+        len = 0;
+        do {
+            if (size - len < (size_t) st.st_blksize) {
+                size = size ? size * 2 : (size_t) st.st_blksize * 16;
+                buf = realloc(text, size);
+                if (!buf) {
+                    fprintf(stderr, "lsh: allocation error\n");
+                    exit(EXIT_FAILURE);
+                }
+                text = buf;
+            }
+            got = read(fd, text + len, size - len);
+            if (got < 0 && errno != EINTR) {
+                fprintf(stderr, "lsh: %s: %s\n", path, strerror(errno));
+                free(text);
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            len += got > 0 ? got : 0;
+        } while (got != 0);
+    }
+    // the programs the script starts don't need the script's file descriptor
+    close(fd);
+
+    status = lsh_run_text(text, len);
+
+    if (mapped) {
+        munmap(text, len);
+    } else {
+        free(text);
+    }
+    return status;
+}
+
+// argc = argument count [holds # of command line arguments passed to program, includes program name itself]
+// argv = argument vector [array of strings (or specifically char*  pointers) containing the command-line arguments passed into program]
+// usage: main                    interactive shell (reads commands from stdin, with a prompt if stdin is a terminal)
+//        main -c 'command...'     runs the commands in the string and exits
+//        main script.lsh          runs the commands in the file and exits
+int main(int argc, char **argv)
+{
+    // Load config files, if any.
+
+    // put the built-ins in the name table that commands are looked up in
+    lsh_init_names();
+
+    // collect children as soon as they change state (needed for background jobs, see lsh_sigchld())
+    // SA_RESTART so that the read of the next command line isn't interrupted when one finishes
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = lsh_sigchld;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // -c and scripts: no prompt and no job control, even with a terminal on stdin
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "lsh: -c: option requires an argument\n");
+            return EXIT_FAILURE;
+        }
+        return lsh_run_text(argv[2], strlen(argv[2]));
+    }
+    if (argc > 1) {
+        return lsh_run_file(argv[1]);
+    }
+
+    // when run from a terminal, the shell lives in its own process group and hands the terminal to each foreground job
+    if (isatty(STDIN_FILENO)) {
+        lsh_interactive = 1;
+        // if we were started in the background, wait until someone puts us in the foreground before taking the terminal
+        while (tcgetpgrp(STDIN_FILENO) != (lsh_pgid = getpgrp())) {
+            kill(-lsh_pgid, SIGTTIN);
+        }
+        // Ctrl-C/Ctrl-Z/... are meant for the foreground job, not for the shell
+        // SIGTTOU is ignored so that taking the terminal back with tcsetpgrp() from the background doesn't stop the shell
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        lsh_pgid = getpid();
+        if (setpgid(lsh_pgid, lsh_pgid) < 0 && errno != EPERM) {
+            perror("lsh");
+            exit(EXIT_FAILURE);
+        }
+        tcsetpgrp(STDIN_FILENO, lsh_pgid);
+        tcgetattr(STDIN_FILENO, &lsh_tmodes);
+    }
+
+    // Run command loop.
+    lsh_loop();
+
+    // Perform any shutdown/cleanup.
+
+    // exit status of the last command (or the one given to exit)
+    return lsh_status;
 }
\ No newline at end of file
@@ -1,8 +1,19 @@
 // simple memory allocator implementing malloc(), realloc(), calloc(), and free()
-#include <unistd.h>			// for sbrk() system call which manipulates brk pointer (used in Unix-like OS)
+#define _GNU_SOURCE			// for mremap(), which is Linux specific
+#include <sys/mman.h>		// for mmap()/munmap()/mremap() system calls which map memory pages into (and out of) the process
+#include <unistd.h>			// for sysconf() to look up the page size
+#include <malloc.h>			// for mallopt() and its M_MMAP_THRESHOLD parameter
 #include <string.h>			// for using memset() in calloc() and memcpy() in realloc()
 #include <pthread.h>		// for locking mechanism preventing multiple thread access
+#include <stdatomic.h>		// for handing out arenas to threads round-robin without a lock
 #include <stdio.h>			// Only added for the printf in debugging function
+#include <stdlib.h>			// for getenv() to read MEMALLOC_CONF
+#include <signal.h>			// for sigaction() to dump the stats on a signal
+#include <errno.h>			// for the EINVAL/ENOMEM posix_memalign() returns
+#include <time.h>			// for clock_gettime() to time the purge intervals
+#include <fcntl.h>			// for open() to write heap profiles and traces
+#include <execinfo.h>		// for backtrace() to record where sampled allocations come from
+#include <sys/auxv.h>		// for getauxval() to seed the hardening secret
 
 // to ensure 16-byte alignment for the memory blocks (an array of 16 chars a.k.a. 16 bytes since 1 char = 1 byte)
 // for performance gains, compatibility, and to avoid weird behavior for some architectures when working with different data types
@@ -12,9 +23,17 @@ typedef char ALIGN[16];
 // header structure for each memory block callable by a user 
 union header {
 	struct {
+		size_t prev_size;				// boundary tag: size of the block right before this one in memory (only valid while prev_free is set)
+										// for a block with its own mapping: how far into the mapping the header sits
 		size_t size;					// size (in bytes) of the memory block
-		unsigned is_free;				// indicates whether memory block is free or not (0/1), if free, we can allocate the block to another malloc() call
-		union header *next;				// pointer to next header in a linked list we make for each malloc() call (useful to determine whether or not a memblock is free)
+		unsigned char is_free;			// indicates whether memory block is free or not (0/1), if free, we can allocate the block to another malloc() call
+		unsigned char prev_free;		// indicates whether the block right before this one in memory is free (so prev_size can be trusted)
+		unsigned char is_mmapped;		// indicates whether the block got its own mmap() (0/1), if so, free() gives it straight back to the OS
+		unsigned char is_purged;		// indicates whether the pages of a free block were already given back to the OS (0/1)
+		unsigned char is_sampled;		// indicates whether the heap profiler is tracking the block (0/1), so free() has to tell it
+		unsigned short check;			// hardened builds: keyed hash of the fields above, to catch smashed headers and double frees
+		unsigned zero_from;				// offset into the payload from which on every byte is known to still be zero (size if none are)
+		unsigned freed_epoch;			// the arena's purge epoch when the block was last put on a free list
 	} s;
 	// forces the size of the union to be a multiple of 16-bytes (16, 32, 64, etc.)
 	ALIGN stub;
@@ -24,206 +43,3456 @@ union header {
 // using typedef so that: header_t = union header 
 typedef union header header_t;
 
-// points to first and last blocks of the linked list
-header_t *head = NULL, *tail = NULL;
-// a global mutex to prevent multiple threads from accessing the memory allocator (synchronize the access to it so that only 1 thread can execute at a time)
-// from pthread header, useful mutex documentation
-pthread_mutex_t global_malloc_lock;
+/*
+   Boundary tags. A block's prev_size/prev_free fields act as the footer of the
+   block in front of it: whenever a block is freed (or changes size while free)
+   it writes its size into the header that follows it. That makes both physical
+   neighbours reachable in O(1), so free() can merge them right away:
+   - the next block starts right after our payload
+   - the previous block starts prev_size bytes before our header (if prev_free)
+   A free block does not use its payload, so its free list links live there.
+ */
+struct free_links {
+	header_t *next;						// next free block in the same size class
+	header_t *prev;						// previous free block in the same size class
+};
+
+// smallest payload a block can have, it has to be able to hold the free list links once the block is freed
+#define MIN_BLOCK_SIZE sizeof(struct free_links)
+
+// the free list links of a free (or thread-cached) block, stored at the start of its payload
+static struct free_links *links(header_t *header)
+{
+	return (struct free_links*)(header + 1);
+}
+
+/*
+   Hardening. Built with -DMEMALLOC_HARDENED, the allocator checks for what a
+   heap overflow or a double free would mess up, for the price of a couple of
+   loads and multiplies per call:
+   - every block handed out carries a check value in its header, a hash of its
+     address, size and flags keyed by a per-process secret; free() and
+     realloc() verify it and free() turns it into the value of a freed block,
+     so a second free() of the same block is told apart from a smashed header
+   - the free mark of a small object is keyed by the secret too, and free()
+     refuses an object that still has it, or that is not at an object boundary
+   - the links between free blocks (free lists, run free lists, thread cache
+     stacks, remote stacks) are stored xor'ed with the secret and their own
+     address, like glibc's safe-linking, so an overflow cannot plant a pointer
+     there, and a link that does not unmangle to an aligned address aborts,
+     as does a free list whose neighbours do not point back at each other
+   Guard pages for the blocks with their own mapping are a separate option
+   (guard:1 in MEMALLOC_CONF), since they cost a page and a system call each.
+ */
+// the per-process secret (stays 0 unless hardened)
+static size_t link_secret;
+
+// writes a message to stderr and aborts
+static void fatal(const char *what)
+{
+	static const char prefix[] = "memalloc: ";
+
+	if (write(STDERR_FILENO, prefix, sizeof(prefix) - 1) < 0 || write(STDERR_FILENO, what, strlen(what)) < 0 ||
+		write(STDERR_FILENO, "\n", 1) < 0)
+		abort();
+	abort();
+}
+
+// reads and writes a link (stored at slot) to another free block
+static void *get_link(void *slot)
+{
+#ifdef MEMALLOC_HARDENED
+	size_t p = (size_t)*(void**)slot ^ ((size_t)slot >> 12) ^ link_secret;
+
+	if (p & (sizeof(ALIGN) - 1))
+		fatal("corrupted free list");
+	return (void*)p;
+#else
+	return *(void**)slot;
+#endif
+}
+
+static void set_link(void *slot, void *p)
+{
+#ifdef MEMALLOC_HARDENED
+	*(void**)slot = (void*)((size_t)p ^ ((size_t)slot >> 12) ^ link_secret);
+#else
+	*(void**)slot = p;
+#endif
+}
+
+#ifdef MEMALLOC_HARDENED
+// takes the secret from the random bytes the kernel hands every process
+static void hardening_init(void)
+{
+	unsigned char *random = (unsigned char*)getauxval(AT_RANDOM);
+
+	if (random)
+		memcpy(&link_secret, random, sizeof(link_secret));
+	// keep the low bits clear, so an unmangled link still has to be aligned
+	link_secret &= ~(size_t)(sizeof(ALIGN) - 1);
+}
+
+static unsigned short header_check(header_t *header, int live)
+{
+	size_t h = ((size_t)header ^ link_secret) * 0x9e3779b97f4a7c15ULL;
+
+	h = (h ^ header->s.size) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (header->s.is_mmapped ? header->s.prev_size : 0)) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ header->s.is_mmapped ^ header->s.is_sampled << 1 ^ live << 2) * 0x9e3779b97f4a7c15ULL;
+	return h >> 48;
+}
+
+// stamps a block that is about to be handed out
+static void seal_header(header_t *header)
+{
+	header->s.check = header_check(header, 1);
+}
+
+// verifies a block the user gave back, and with retire set stamps it as freed
+static void check_header(header_t *header, int retire)
+{
+	if (header->s.check != header_check(header, 1))
+		fatal(header->s.check == header_check(header, 0) ? "double free" : "corrupted block header (or invalid pointer)");
+	if (retire)
+		header->s.check = header_check(header, 0);
+}
+#else
+#define hardening_init() ((void)0)
+#define seal_header(header) ((void)0)
+#define check_header(header, retire) ((void)0)
+#endif
+
+/*
+   Known-zero memory. Pages fresh from mmap() are zero, and most of a block carved
+   out of a new chunk has never been written, so calloc() does not need to clear
+   it again. Each chunk block tracks zero_from, the offset past which its payload
+   is untouched. Writing the free list links only dirties the first bytes, a user
+   free() dirties all of it, and splits and merges carry the clean tail along.
+   A block with its own mapping is always fresh, so it needs no tracking at all.
+ */
+// marks the start of the payload as written, called right before the free list links get stored there
+static void touch_links(header_t *header)
+{
+	if (header->s.zero_from < MIN_BLOCK_SIZE)
+		header->s.zero_from = MIN_BLOCK_SIZE;
+}
+
+/*
+   Heap chunks. Instead of growing the program break one sbrk() at a time, the
+   heap is made of CHUNK_SIZE regions from mmap(), each aligned to its own size
+   so the chunk of any block can be found by masking the address. A chunk is a
+   struct chunk followed by blocks laid out back to back, and a zero-sized
+   "fence" header that is never free closes it off so merging stops there.
+   Requests of mmap_threshold bytes or more skip the chunks and get their own
+   mapping, which free() hands straight back with munmap().
+   A chunk is exactly one huge page (see below), so the kernel can back each
+   with a single TLB entry.
+ */
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define CHUNK_SIZE HUGE_PAGE_SIZE
+// the biggest block a chunk can hold (everything past it has to be mmap()ed on its own)
+#define CHUNK_MAX_BLOCK (CHUNK_SIZE - sizeof(struct chunk) - 2 * sizeof(header_t))
+#define DEFAULT_MMAP_THRESHOLD ((size_t)128 * 1024)
+
+struct chunk {
+	struct chunk *next;					// next chunk in the owning arena's list of chunks
+	struct chunk *prev;					// previous chunk in the owning arena's list of chunks
+	struct arena *arena;				// the arena every block in this chunk belongs to
+	size_t pad;							// keeps the first block 16-byte aligned
+};
+
+// requests this big or bigger get a mapping of their own (tunable through mallopt(M_MMAP_THRESHOLD, ...))
+size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+// whether every block with its own mapping gets an inaccessible guard page right past its end (guard:1 in MEMALLOC_CONF)
+static int guard_pages;
+
+/*
+   Huge pages. Chunks and slab extents are HUGE_PAGE_SIZE each and aligned to
+   it, so each one can sit in a single transparent huge page. thp:always in
+   MEMALLOC_CONF asks the kernel for those with madvise(MADV_HUGEPAGE) (as well
+   as for blocks with a mapping of their own that are that big), thp:never
+   keeps all of it on small pages, and by default the system setting decides.
+   Giving back a single page of a huge page would split it up again, so as
+   long as huge pages are in use purging only ever gives back whole ones:
+   a slab extent whose runs were all released, and the spare chunk. The free
+   pages inside the other chunks stay until they are reused.
+ */
+enum { THP_DEFAULT, THP_ALWAYS, THP_NEVER };
+
+static int thp_mode = THP_DEFAULT;
+// whether purging keeps to whole huge pages
+static int huge_purge;
+
+// tells the kernel whether to back an aligned region with huge pages (only if MEMALLOC_CONF asked for it either way)
+static void advise_huge(void *start, size_t length)
+{
+	if (thp_mode == THP_ALWAYS)
+		madvise(start, length, MADV_HUGEPAGE);
+	else if (thp_mode == THP_NEVER)
+		madvise(start, length, MADV_NOHUGEPAGE);
+}
+
+// works out whether huge pages are in play: always if asked for, and with the system default only if it uses them everywhere
+static void thp_init(void)
+{
+	char buf[64];
+	ssize_t n;
+	int fd;
+
+	if (thp_mode != THP_DEFAULT) {
+		huge_purge = thp_mode == THP_ALWAYS;
+		return;
+	}
+	if ((fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n > 0) {
+		buf[n] = '\0';
+		huge_purge = strstr(buf, "[always]") != NULL;
+	}
+}
+
+/*
+   Size classes. Each class keeps its own free list, so a lookup only has to
+   check the list of the class that can satisfy it:
+   - small classes are spaced 16 bytes apart (16, 32, ..., 256)
+   - medium classes are powers of two (512, 1K, ..., 1M)
+   - anything above that lands in one "large" class that is searched first-fit
+   A free block sits on the list of the largest class it can fully hold, so any
+   block popped from the list a request maps to (or a larger one) is big enough.
+ */
+#define SMALL_CLASS_STEP 16
+#define NUM_SMALL_CLASSES 16
+#define SMALL_CLASS_MAX (SMALL_CLASS_STEP * NUM_SMALL_CLASSES)
+#define MEDIUM_CLASS_MIN_SHIFT 9				// 512 bytes
+#define MEDIUM_CLASS_MAX_SHIFT 20				// 1 MB
+#define NUM_MEDIUM_CLASSES (MEDIUM_CLASS_MAX_SHIFT - MEDIUM_CLASS_MIN_SHIFT + 1)
+#define LARGE_CLASS (NUM_SMALL_CLASSES + NUM_MEDIUM_CLASSES)
+#define NUM_CLASSES (LARGE_CLASS + 1)
+
+// rounds a size up to the 16-byte granularity every block size is kept at
+#define ROUND_UP(size) (((size) + SMALL_CLASS_STEP - 1) & ~(size_t)(SMALL_CLASS_STEP - 1))
+
+/*
+   Arenas. The shared heap is split into independent arenas, each with its own
+   lock, free lists and chunks, so threads that miss their cache only contend
+   with the threads sharing their arena. There is one arena per CPU (up to
+   MAX_ARENAS) and threads are handed out to them round-robin on first use.
+   Every chunk records its arena, so free() from any thread finds the owner of
+   a block with one mask and one load and returns it there, in batches when it
+   comes from a thread cache flush.
+   A thread never takes the lock of an arena other than its own to do that:
+   blocks for another arena are pushed onto that arena's remote_frees stack
+   with a single CAS (a batch from a cache flush goes in as one chain), and the
+   threads of the owning arena take the whole stack with one exchange and
+   release it the next time they hold their lock on a slow path. An arena with
+   no threads left would never do that, so frees for it take its lock instead,
+   and never while holding the lock of another arena (a thread cache flush
+   lets go of its own first).
+ */
+#define MAX_ARENAS 64
+
+struct arena {
+	// a mutex to prevent multiple threads from accessing the arena at once (synchronize the access to it so that only 1 thread can execute at a time)
+	// from pthread header, useful mutex documentation
+	pthread_mutex_t lock;
+	// one doubly linked free list per size class, linked through the free_links in each block's payload
+	header_t *free_lists[NUM_CLASSES];
+	// all chunks currently mapped for this arena (newest first)
+	struct chunk *chunks;
+	// a chunk that became completely free is kept around as a spare, so a heap hovering around a chunk boundary does not map and unmap one every time
+	struct chunk *spare_chunk;
+	// per small class, the runs that still have objects to hand out (see the slab runs below)
+	struct run *partial_runs[NUM_SMALL_CLASSES];
+	// runs with no objects in use left, ready to be given any class
+	struct run *empty_runs;
+	size_t num_empty_runs;
+	// empty runs whose memory went back to the OS, as an index into released_next (plus one, 0 ends the list)
+	size_t released_runs;
+	size_t num_released_runs;
+	// the part of the arena's current slab extent that has not been made into runs yet
+	char *slab_next;
+	char *slab_end;
+	// purging: the epoch counts the decay intervals that went by, and the next one ends at next_purge (in ms)
+	unsigned purge_epoch;
+	unsigned long long next_purge;
+	// how many of the empty runs were already empty when the last interval ended (the bottom ones of empty_runs)
+	size_t aged_empty_runs;
+	// statistics, kept under the lock like everything else in here
+	size_t num_chunks;					// chunks currently mapped
+	size_t slab_bytes;					// bytes of the slab zone made usable for this arena's runs
+	size_t num_runs;					// runs handed out from those, in use or empty
+	size_t free_bytes;					// bytes sitting on the free lists
+	size_t free_count[NUM_CLASSES];		// length of each free list
+	unsigned long long lock_count;		// times the lock was taken
+	unsigned long long lock_contended;	// times the lock was already held by another thread and we had to wait
+	unsigned long long remote_collected;	// blocks taken off remote_frees
+	unsigned long long purged_bytes;	// bytes given back to the OS by purging
+	// threads using the arena right now (no lock needed to read or change it)
+	atomic_uint num_threads;
+	// blocks (their payloads, linked through the first word) freed by threads of other arenas, written without the lock
+	// on a cache line of its own so those threads do not slow down the ones working under the lock
+	_Atomic(void*) remote_frees __attribute__((aligned(64)));
+} __attribute__((aligned(64)));			// a cache line each, so locking one arena does not slow down its neighbour (false sharing)
+
+struct arena arenas[MAX_ARENAS];
+unsigned num_arenas;
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+// bumped for every new thread, the arena it gets is this modulo num_arenas
+static atomic_uint next_arena;
+// the arena the calling thread allocates from (picked the first time it needs one)
+static __thread struct arena *thread_arena __attribute__((tls_model("initial-exec")));
+
+// takes an arena lock, counting how often someone else already had it
+static void arena_lock(struct arena *arena)
+{
+	if (pthread_mutex_trylock(&arena->lock)) {
+		pthread_mutex_lock(&arena->lock);
+		arena->lock_contended++;
+	}
+	arena->lock_count++;
+}
+
+static void arena_unlock(struct arena *arena)
+{
+	pthread_mutex_unlock(&arena->lock);
+}
+
+// bytes currently mapped from the OS (chunks plus blocks with their own mapping), and how many of the latter there are
+static atomic_size_t mapped_bytes, mapped_blocks, mapped_block_bytes;
+
+// maps a request size to the index of the smallest class that can hold it
+static unsigned size_class(size_t size)
+{
+	unsigned shift;
+
+	if (size <= SMALL_CLASS_MAX)
+		return (size + SMALL_CLASS_STEP - 1) / SMALL_CLASS_STEP - 1;
+	if (size > ((size_t)1 << MEDIUM_CLASS_MAX_SHIFT))
+		return LARGE_CLASS;
+	// ceil(log2(size)), __builtin_clzl counts the leading zero bits (so this is just a couple of instructions)
+	shift = sizeof(unsigned long) * 8 - __builtin_clzl(size - 1);
+	return NUM_SMALL_CLASSES + shift - MEDIUM_CLASS_MIN_SHIFT;
+}
+
+// maps the size of a block to the free list it is kept on: the largest class whose requests it can always satisfy
+static unsigned block_class(size_t size)
+{
+	unsigned shift;
+
+	if (size < ((size_t)1 << MEDIUM_CLASS_MIN_SHIFT))
+		return size >= SMALL_CLASS_MAX ? NUM_SMALL_CLASSES - 1 : size / SMALL_CLASS_STEP - 1;
+	if (size > ((size_t)1 << MEDIUM_CLASS_MAX_SHIFT))
+		return LARGE_CLASS;
+	// floor(log2(size))
+	shift = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size);
+	return NUM_SMALL_CLASSES + shift - MEDIUM_CLASS_MIN_SHIFT;
+}
+
+// the full size of a (non-large) class, which is what every block handed out through a thread cache gets rounded up to
+static size_t class_size(unsigned class)
+{
+	if (class < NUM_SMALL_CLASSES)
+		return (size_t)(class + 1) * SMALL_CLASS_STEP;
+	return (size_t)1 << (class - NUM_SMALL_CLASSES + MEDIUM_CLASS_MIN_SHIFT);
+}
+
+// the chunk a (non-mmapped) block belongs to, chunks are aligned to CHUNK_SIZE so this is just a mask
+static struct chunk *chunk_of(header_t *header)
+{
+	return (struct chunk*)((size_t)header & ~(CHUNK_SIZE - 1));
+}
+
+// the first block of a chunk, right after the chunk header
+static header_t *chunk_first_block(struct chunk *chunk)
+{
+	return (header_t*)(chunk + 1);
+}
+
+// the block right after this one in memory (the fence if this is the last block of its chunk)
+static header_t *next_block(header_t *header)
+{
+	return (header_t*)((char*)(header + 1) + header->s.size);
+}
+
+// the block right before this one in memory, found through the boundary tag, or NULL unless that block is free
+static header_t *prev_block(header_t *header)
+{
+	if (!header->s.prev_free)
+		return NULL;
+	return (header_t*)((char*)header - header->s.prev_size - sizeof(header_t));
+}
+
+// writes this block's boundary tag (its size and free state) into the header of the block that follows it
+static void set_footer(header_t *header)
+{
+	header_t *next = next_block(header);
+
+	next->s.prev_size = header->s.size;
+	next->s.prev_free = header->s.is_free;
+}
+
+// marks a block free and pushes it onto the free list of its class
+static void insert_free_block(struct arena *arena, header_t *header)
+{
+	unsigned class = block_class(header->s.size);
+
+	header->s.is_free = 1;
+	// dirty from now on, the purge leaves it alone until it stayed free for a full decay interval
+	header->s.is_purged = 0;
+	header->s.freed_epoch = arena->purge_epoch;
+	arena->free_count[class]++;
+	arena->free_bytes += header->s.size;
+	touch_links(header);
+	set_link(&links(header)->next, arena->free_lists[class]);
+	set_link(&links(header)->prev, NULL);
+	if (arena->free_lists[class])
+		set_link(&links(arena->free_lists[class])->prev, header);
+	arena->free_lists[class] = header;
+	set_footer(header);
+}
+
+// unlinks a free block from the middle of its free list in O(1) and marks it in use
+static void remove_free_block(struct arena *arena, header_t *header)
+{
+	header_t *next = get_link(&links(header)->next), *prev = get_link(&links(header)->prev);
+
+#ifdef MEMALLOC_HARDENED
+	if ((prev ? get_link(&links(prev)->next) : arena->free_lists[block_class(header->s.size)]) != header ||
+		(next && get_link(&links(next)->prev) != header))
+		fatal("corrupted free list");
+#endif
+	arena->free_count[block_class(header->s.size)]--;
+	arena->free_bytes -= header->s.size;
+	if (prev)
+		set_link(&links(prev)->next, next);
+	else
+		arena->free_lists[block_class(header->s.size)] = next;
+	if (next)
+		set_link(&links(next)->prev, prev);
+	header->s.is_free = 0;
+	set_footer(header);
+	// the spare chunk is about to be used again
+	if (arena->spare_chunk && header == chunk_first_block(arena->spare_chunk))
+		arena->spare_chunk = NULL;
+}
+
+// maps a new chunk for an arena and returns its single big block, in use, or NULL if mmap() failed; caller holds the arena lock
+static header_t *new_chunk(struct arena *arena)
+{
+	struct chunk *chunk;
+	header_t *first, *fence;
+	char *map;
+	size_t lead;
+
+	// mmap() only promises page alignment, so map twice the size and cut the aligned chunk out of the middle
+	map = mmap(NULL, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	lead = -(size_t)map & (CHUNK_SIZE - 1);
+	if (lead)
+		munmap(map, lead);
+	munmap(map + lead + CHUNK_SIZE, CHUNK_SIZE - lead);
+	chunk = (struct chunk*)(map + lead);
+	advise_huge(chunk, CHUNK_SIZE);
+	arena->num_chunks++;
+	atomic_fetch_add(&mapped_bytes, CHUNK_SIZE);
+	// add it to the front of the arena's chunk list
+	chunk->arena = arena;
+	chunk->prev = NULL;
+	chunk->next = arena->chunks;
+	if (arena->chunks)
+		arena->chunks->prev = chunk;
+	arena->chunks = chunk;
+	// fresh pages from mmap() are already zeroed, so only the fields that must be non-zero get set
+	first = chunk_first_block(chunk);
+	first->s.size = CHUNK_MAX_BLOCK;
+	fence = next_block(first);
+	fence->s.size = 0;
+	return first;
+}
+
+// unlinks a chunk from its arena's chunk list and gives its memory back to the OS; caller holds the arena lock
+static void delete_chunk(struct arena *arena, struct chunk *chunk)
+{
+	if (chunk->prev)
+		chunk->prev->next = chunk->next;
+	else
+		arena->chunks = chunk->next;
+	if (chunk->next)
+		chunk->next->prev = chunk->prev;
+	arena->num_chunks--;
+	atomic_fetch_sub(&mapped_bytes, CHUNK_SIZE);
+	munmap(chunk, CHUNK_SIZE);
+}
+
+// hands a block back to the shared heap: merges it with free neighbours, then either gives an emptied chunk back to
+// the OS or puts the block on its size class list; caller holds the lock of the arena the block belongs to
+static void release_block(struct arena *arena, header_t *header)
+{
+	header_t *next, *prev;
+	struct chunk *chunk;
+
+	// merge with the following block if it is free: it simply disappears into this one (and only its clean tail stays known zero)
+	if ((next = next_block(header))->s.is_free) {
+		remove_free_block(arena, next);
+		header->s.zero_from = header->s.size + sizeof(header_t) + next->s.zero_from;
+		header->s.size += sizeof(header_t) + next->s.size;
+	}
+	// merge with the preceding block if it is free: this one disappears into it
+	if ((prev = prev_block(header))) {
+		remove_free_block(arena, prev);
+		prev->s.zero_from = prev->s.size + sizeof(header_t) + header->s.zero_from;
+		prev->s.size += sizeof(header_t) + header->s.size;
+		header = prev;
+	}
+	/*
+	   Check if the block now covers its whole chunk. If it does,
+	   the chunk is unmapped, which releases the memory to OS unless
+	   it is the first one to empty out, in which case it stays as the
+	   spare. Else, we will keep the block but mark it as free.
+	 */
+	chunk = chunk_of(header);
+	if (header == chunk_first_block(chunk) && header->s.size == CHUNK_MAX_BLOCK) {
+		if (arena->spare_chunk) {
+			delete_chunk(arena, chunk);
+			return;
+		}
+		arena->spare_chunk = chunk;
+	}
+	// after that or if block not covering a chunk, set marker so that block is free and put it on its size class list
+	insert_free_block(arena, header);
+}
+
+// cuts a block down to `size` bytes and returns the rest as a block of its own (in use), or NULL if the rest is too small to be one
+static header_t *cut_block(header_t *header, size_t size)
+{
+	header_t *rest;
+
+	if (header->s.size < size + sizeof(header_t) + MIN_BLOCK_SIZE)
+		return NULL;
+	rest = (header_t*)((char*)(header + 1) + size);
+	rest->s.size = header->s.size - size - sizeof(header_t);
+	rest->s.is_free = 0;
+	rest->s.is_mmapped = 0;
+	rest->s.is_sampled = 0;
+	rest->s.prev_free = header->s.is_free;
+	rest->s.prev_size = size;
+	// the clean tail of the block carries over to whichever part it ends up in
+	if (header->s.zero_from > size + sizeof(header_t))
+		rest->s.zero_from = header->s.zero_from - size - sizeof(header_t);
+	else
+		rest->s.zero_from = 0;
+	if (header->s.zero_from > size)
+		header->s.zero_from = size;
+	header->s.size = size;
+	return rest;
+}
+
+// cuts a block down to `size` bytes, handing the rest back to the shared heap if it is big enough to be a block of its own
+// caller holds the arena lock
+static void split_block(struct arena *arena, header_t *header, size_t size)
+{
+	header_t *rest = cut_block(header, size);
+
+	if (rest)
+		release_block(arena, rest);
+}
 
-// traverses the linked list to find a memory block that is free and that can accomodate given size within the parameter
+// finds a free block that can accomodate given size (a multiple of 16) and splits off whatever it does not need
+// only the class of the request is looked at, and then the larger classes if that one is empty
 // notice we are using header_t as a shortcut for union header
-header_t *get_free_block(size_t size)
+header_t *get_free_block(struct arena *arena, size_t size)
 {
-	// standard linked list traversal starting at head (the beginning) of linked list
-	// by using curr ptr, we manipulate its position in linked list by traversal instead of the head ptr
-	header_t *curr = head;
-	// while there are still memory blocks in linked list
-	while(curr) {
-		// see if there's a free block that can accomodate requested size 
-		if (curr->s.is_free && curr->s.size >= size)
-			return curr;				// return a pointer to that block if so
-		curr = curr->s.next;			// otherwise go to next block
+	header_t *curr = NULL;
+	unsigned class;
+
+	// every block on a small/medium list is at least as big as any request mapped to that class, so just take the head
+	for (class = size_class(size); class < LARGE_CLASS && !curr; class++)
+		curr = arena->free_lists[class];
+	// the large class holds blocks of any size above 1 MB, so walk it first-fit
+	if (!curr)
+		for (curr = arena->free_lists[LARGE_CLASS]; curr && curr->s.size < size; curr = get_link(&links(curr)->next))
+			;
+	// if not found within any list, return null ptr
+	if (!curr)
+		return NULL;
+	remove_free_block(arena, curr);
+	split_block(arena, curr, size);
+	return curr;
+}
+
+// takes a block able to hold `size` bytes (a multiple of 16, at most CHUNK_MAX_BLOCK) from the shared heap, or NULL if out of memory
+// caller holds the arena lock
+static header_t *acquire_block(struct arena *arena, size_t size)
+{
+	header_t *header;
+
+	// searches the size class free lists for an existing free memblock that can hold requested size
+	if ((header = get_free_block(arena, size))) {
+		/* Woah, found a free block to accomodate requested memory. */
+		return header;
+	}
+	// Otherwise, map a new chunk, take the front of it and leave the rest on the free lists for later requests
+	if (!(header = new_chunk(arena)))
+		return NULL;
+	split_block(arena, header, size);
+	return header;
+}
+
+// the arena a (non-mmapped) block belongs to
+static struct arena *arena_of(header_t *header)
+{
+	return chunk_of(header)->arena;
+}
+
+// the system page size, looked up once
+static size_t page_size(void)
+{
+	static size_t size;
+
+	if (!size)
+		size = sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+/*
+   Slab runs. Small objects (the small size classes, up to 256 bytes) have no
+   header at all. They are carved out of RUN_SIZE runs, each holding objects
+   of a single class, with one struct run at the front of the run describing
+   all of them. Runs are aligned to RUN_SIZE, so the run (and with it the size
+   class and the owning arena) of an object is found by masking its address.
+   All runs live in one slab zone of address space reserved up front, which
+   is what tells free() whether a pointer is a headerless object: a single
+   range check, no memory is read for blocks outside the zone. The zone is
+   made usable one SLAB_EXTENT at a time per arena, and runs are cut from it.
+   A free object holds the link to the next free object of its run (or of the
+   thread cache list it sits on) in its first word and a free mark in its
+   second, so nothing about it needs to be stored anywhere else.
+   An empty run past the few an arena keeps around gives all of its memory
+   back, header included, so the list of those runs is kept out of band in
+   released_next, one entry per run of the zone (only touched when used).
+   If the zone cannot be reserved (e.g. under a tight RLIMIT_AS), or runs out,
+   small requests simply get headered blocks from the arena like larger ones.
+ */
+#define RUN_SHIFT 16						// 64 KB runs
+#define RUN_SIZE ((size_t)1 << RUN_SHIFT)
+#define SLAB_EXTENT HUGE_PAGE_SIZE
+#define RUNS_PER_EXTENT (SLAB_EXTENT / RUN_SIZE)
+#define SLAB_ZONE_SIZE ((size_t)16 << 30)	// 16 GB of address space (only what runs use is ever backed by memory)
+// how many empty runs an arena keeps ready to use, the memory of any others goes back to the OS
+#define SPARE_RUNS 4
+
+struct run {
+	struct arena *arena;				// the arena the run belongs to
+	struct run *next;					// next run in the arena's partial list of this class (or its empty list)
+	struct run *prev;					// previous run in the arena's partial list of this class
+	void *free_list;					// objects freed back to the run
+	char *bump;							// objects past this were never handed out
+	unsigned class;						// size class of every object in the run
+	unsigned size;						// size of every object in the run
+	unsigned capacity;					// objects the run holds
+	unsigned used;						// objects handed out (to the user or a thread cache)
+	size_t pad;							// keeps the first object 16-byte aligned
+};
+
+// the layout of a free object
+struct slab_free {
+	void *next;
+	size_t mark;
+};
+
+// the mark a free object of a run carries, so a freed object can be told apart from one in use
+#define SLAB_FREE_MARK ((size_t)0x5ab0f4eeUL)
+
+static char *slab_zone;
+// bytes of the zone that are reserved, 0 if there is no zone
+static size_t slab_zone_size;
+// how much of the zone has been handed out to arenas as extents
+static atomic_size_t slab_zone_used;
+// the links of the arenas' lists of released runs, by run index
+static unsigned *released_next;
+// how many runs of each extent are released, by extent index (only counted while purging keeps to huge pages)
+static unsigned char extent_released[SLAB_ZONE_SIZE / SLAB_EXTENT];
+
+// whether a pointer is a headerless object from a run
+static int is_slab(void *p)
+{
+	return (size_t)((char*)p - slab_zone) < slab_zone_size;
+}
+
+// the run an object belongs to
+static struct run *run_of(void *p)
+{
+	return (struct run*)((size_t)p & ~(RUN_SIZE - 1));
+}
+
+static size_t slab_mark(struct run *run)
+{
+	return SLAB_FREE_MARK ^ (size_t)run ^ link_secret;
+}
+
+#ifdef MEMALLOC_HARDENED
+// an object the user gives back has to be at an object boundary of a run, and must not carry the free mark already
+static void check_slab(void *block)
+{
+	struct run *run = run_of(block);
+	char *first = (char*)(run + 1);
+
+	if (!run->size || (char*)block < first || (char*)block >= run->bump || ((char*)block - first) % run->size)
+		fatal("invalid pointer");
+	if (((struct slab_free*)block)->mark == slab_mark(run))
+		fatal("double free");
+}
+#else
+#define check_slab(block) ((void)0)
+#endif
+
+// reserves the slab zone (address space only), runs once with the arenas
+static void slab_zone_init(void)
+{
+	char *map = mmap(NULL, SLAB_ZONE_SIZE + SLAB_EXTENT, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	size_t lead;
+
+	if (map == MAP_FAILED)
+		return;
+	released_next = mmap(NULL, SLAB_ZONE_SIZE / RUN_SIZE * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (released_next == MAP_FAILED) {
+		munmap(map, SLAB_ZONE_SIZE + SLAB_EXTENT);
+		return;
+	}
+	// cut a zone out of it that is aligned to the extents, so every extent is one huge page
+	lead = -(size_t)map & (SLAB_EXTENT - 1);
+	if (lead)
+		munmap(map, lead);
+	munmap(map + lead + SLAB_ZONE_SIZE, SLAB_EXTENT - lead);
+	slab_zone = map + lead;
+	slab_zone_size = SLAB_ZONE_SIZE;
+}
+
+// takes a run for a class from the arena (an empty one, or a new one from its extent), NULL if the zone is used up; caller holds the arena lock
+static struct run *new_run(struct arena *arena, unsigned class)
+{
+	struct run *run;
+	size_t offset;
+
+	if ((run = arena->empty_runs)) {
+		arena->empty_runs = run->next;
+		arena->num_empty_runs--;
+		// the run came off the top, which is only an aged one once all of them are (see purge_arena())
+		if (arena->aged_empty_runs > arena->num_empty_runs)
+			arena->aged_empty_runs = arena->num_empty_runs;
+	} else if (arena->released_runs) {
+		// its memory is only zero if it really went back to the OS: without huge pages release_run() always gives it back,
+		// with them only once the whole extent was released, so a run of a partly released extent keeps its old contents
+		// (nothing counts on either, slab calloc() always clears the object)
+		run = (struct run*)(slab_zone + ((arena->released_runs - 1) << RUN_SHIFT));
+		arena->released_runs = released_next[arena->released_runs - 1];
+		arena->num_released_runs--;
+		if (huge_purge)
+			extent_released[((char*)run - slab_zone) / SLAB_EXTENT]--;
+	} else {
+		if (arena->slab_next == arena->slab_end) {
+			offset = atomic_fetch_add(&slab_zone_used, SLAB_EXTENT);
+			if (offset + SLAB_EXTENT > slab_zone_size)
+				return NULL;
+			// the reserved pages become ordinary (still zero) memory
+			if (mprotect(slab_zone + offset, SLAB_EXTENT, PROT_READ | PROT_WRITE))
+				return NULL;
+			advise_huge(slab_zone + offset, SLAB_EXTENT);
+			arena->slab_next = slab_zone + offset;
+			arena->slab_end = slab_zone + offset + SLAB_EXTENT;
+			arena->slab_bytes += SLAB_EXTENT;
+			atomic_fetch_add(&mapped_bytes, SLAB_EXTENT);
+		}
+		run = (struct run*)arena->slab_next;
+		arena->slab_next += RUN_SIZE;
+		arena->num_runs++;
+	}
+	run->arena = arena;
+	run->free_list = NULL;
+	run->bump = (char*)(run + 1);
+	run->class = class;
+	run->size = class_size(class);
+	run->capacity = (RUN_SIZE - sizeof(struct run)) / run->size;
+	run->used = 0;
+	// make it the arena's partial run for the class
+	run->prev = NULL;
+	run->next = arena->partial_runs[class];
+	if (run->next)
+		run->next->prev = run;
+	arena->partial_runs[class] = run;
+	return run;
+}
+
+// takes a run off the arena's partial list of its class
+static void unlink_run(struct arena *arena, struct run *run)
+{
+	if (run->prev)
+		run->prev->next = run->next;
+	else
+		arena->partial_runs[run->class] = run->next;
+	if (run->next)
+		run->next->prev = run->prev;
+}
+
+// hands out an object of a class from the arena's runs, NULL if there is no run left to use; caller holds the arena lock
+static void *slab_alloc(struct arena *arena, unsigned class)
+{
+	struct run *run = arena->partial_runs[class];
+	struct slab_free *obj;
+
+	if (!run && !(run = new_run(arena, class)))
+		return NULL;
+	// recycled objects first, then fresh ones from the end of the run
+	if ((obj = run->free_list)) {
+		run->free_list = get_link(&obj->next);
+	} else {
+		obj = (struct slab_free*)run->bump;
+		run->bump += run->size;
+	}
+	// a recycled run can still have an old mark where its fresh objects are
+	obj->mark = 0;
+	// a full run leaves the partial list until one of its objects comes back
+	if (++run->used == run->capacity)
+		unlink_run(arena, run);
+	return obj;
+}
+
+// gives all the memory of an empty run (which is on no list) back to the OS and puts it on the arena's released list
+static void release_run(struct arena *arena, struct run *run)
+{
+	size_t index = ((char*)run - slab_zone) >> RUN_SHIFT;
+	char *extent = slab_zone + index / RUNS_PER_EXTENT * SLAB_EXTENT;
+
+	if (!huge_purge) {
+		madvise(run, RUN_SIZE, MADV_DONTNEED);
+		arena->purged_bytes += RUN_SIZE;
+	} else if (++extent_released[index / RUNS_PER_EXTENT] == RUNS_PER_EXTENT) {
+		// with huge pages the run only goes back with the rest of its extent, once all of them are released
+		madvise(extent, SLAB_EXTENT, MADV_DONTNEED);
+		arena->purged_bytes += SLAB_EXTENT;
 	}
-	return NULL;						// if not found within list, return null ptr
-} 
+	released_next[index] = arena->released_runs;
+	arena->released_runs = index + 1;
+	arena->num_released_runs++;
+}
+
+// gives an object back to its run; caller holds the lock of the arena owning the run
+static void slab_release(struct arena *arena, void *p)
+{
+	struct run *run = run_of(p);
+	struct slab_free *obj = p;
+
+	set_link(&obj->next, run->free_list);
+	obj->mark = slab_mark(run);
+	run->free_list = obj;
+	if (run->used-- == run->capacity) {
+		run->prev = NULL;
+		run->next = arena->partial_runs[run->class];
+		if (run->next)
+			run->next->prev = run;
+		arena->partial_runs[run->class] = run;
+	}
+	if (run->used)
+		return;
+	// the run is empty: keep it for any class, or give its memory back if the arena already keeps enough of them
+	unlink_run(arena, run);
+	if (arena->num_empty_runs >= SPARE_RUNS) {
+		release_run(arena, run);
+		return;
+	}
+	run->next = arena->empty_runs;
+	arena->empty_runs = run;
+	arena->num_empty_runs++;
+}
+
+// gives a block (by its payload, either kind) back to its arena; caller holds the lock of that arena
+static void release_payload(struct arena *arena, void *p)
+{
+	if (is_slab(p))
+		slab_release(arena, p);
+	else
+		release_block(arena, (header_t*)p - 1);
+}
+
+/*
+   Purging. free() never gives memory back to the OS by itself (apart from
+   blocks with their own mapping and chunks that empty out completely), so the
+   whole pages inside free blocks and empty runs are handed back with madvise()
+   once they stayed unused for a while. Time is cut into purge_decay_ms long
+   intervals per arena, counted by its purge_epoch, and at the end of each
+   interval everything that was already free when the previous one ended (so
+   for at least a full interval) is purged. All of it happens on the slow path:
+   the first time an arena's own thread takes its lock after an interval ended
+   it sweeps the arena, so the fast path does not even look at a clock. A
+   negative decay turns purging off, 0 purges on every slow path, and
+   malloc_trim() purges everything right away.
+ */
+#define DEFAULT_PURGE_DECAY_MS 1000
+
+long purge_decay_ms = DEFAULT_PURGE_DECAY_MS;
+// MADV_DONTNEED makes purged pages read back as zero, which calloc() can use; MADV_FREE is lazier but keeps no such promise
+int purge_advice = MADV_DONTNEED;
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	// the coarse clock is read from the vDSO without a system call, and a few ms off does not matter here
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// the pages purging works in: whole huge pages while those are in use, so none gets split
+static size_t purge_unit(void)
+{
+	return huge_purge ? HUGE_PAGE_SIZE : page_size();
+}
+
+// gives the whole pages inside a free block back to the OS (keeping the free list links at its start and the next header)
+static void purge_block(struct arena *arena, header_t *header)
+{
+	char *payload = (char*)(header + 1);
+	char *start = (char*)(((size_t)payload + MIN_BLOCK_SIZE + purge_unit() - 1) & ~(purge_unit() - 1));
+	char *end = (char*)((size_t)next_block(header) & ~(purge_unit() - 1));
+
+	header->s.is_purged = 1;
+	if (start >= end)
+		return;
+	madvise(start, end - start, purge_advice);
+	arena->purged_bytes += end - start;
+	// the purged pages read back as zero, so if everything past them already was, so is everything past their start
+	if (purge_advice == MADV_DONTNEED && header->s.zero_from <= end - payload && header->s.zero_from > start - payload)
+		header->s.zero_from = start - payload;
+}
+
+// purges the free blocks that have been free since before `epoch` (or all of them) and the empty runs that are old enough
+// caller holds the arena lock
+static void purge_arena(struct arena *arena, unsigned epoch, int all)
+{
+	header_t *curr;
+	struct run *run, **link;
+	size_t keep;
+	unsigned class;
+
+	// a chunk is a single huge page, so with huge pages the only one that can go back is the spare chunk, all of it
+	if (huge_purge && arena->spare_chunk) {
+		curr = chunk_first_block(arena->spare_chunk);
+		if (all || (int)(epoch - curr->s.freed_epoch) > 0) {
+			remove_free_block(arena, curr);
+			delete_chunk(arena, chunk_of(curr));
+			arena->purged_bytes += CHUNK_SIZE;
+		}
+	}
+	// a block needs at least two pages to have a whole one that is not shared with its header or the next one
+	for (class = block_class(2 * purge_unit()); class < NUM_CLASSES; class++)
+		for (curr = arena->free_lists[class]; curr; curr = get_link(&links(curr)->next))
+			if (!curr->s.is_purged && (all || (int)(epoch - curr->s.freed_epoch) > 0))
+				purge_block(arena, curr);
+	// new empty runs are pushed on top, so the ones that were already there last time are at the bottom of the list
+	// (new_run() takes from the top, and counts one less aged run whenever it has to take one of those)
+	keep = all ? 0 : arena->num_empty_runs - arena->aged_empty_runs;
+	for (link = &arena->empty_runs; keep; keep--)
+		link = &(*link)->next;
+	while ((run = *link)) {
+		*link = run->next;
+		arena->num_empty_runs--;
+		release_run(arena, run);
+	}
+	arena->aged_empty_runs = arena->num_empty_runs;
+}
+
+// ends the current decay interval of an arena if it is over, purging what stayed free for a whole interval; caller holds the arena lock
+static void maybe_purge(struct arena *arena)
+{
+	unsigned long long now;
+
+	if (purge_decay_ms < 0)
+		return;
+	now = now_ms();
+	if (now < arena->next_purge)
+		return;
+	arena->next_purge = now + purge_decay_ms;
+	arena->purge_epoch++;
+	// what was freed in the interval that just ended is too young, everything before that goes
+	purge_arena(arena, purge_decay_ms ? arena->purge_epoch - 1 : arena->purge_epoch + 1, 0);
+}
+
+// glibc's malloc_trim(): purges every arena right away, `pad` is ignored since nothing is trimmed off a program break
+// returns 1 if any memory went back to the OS
+int malloc_trim(size_t pad)
+{
+	unsigned long long before, after = 0;
+	unsigned i;
+
+	(void)pad;
+	for (i = 0, before = 0; i < num_arenas; i++) {
+		arena_lock(&arenas[i]);
+		before += arenas[i].purged_bytes;
+		purge_arena(&arenas[i], 0, 1);
+		after += arenas[i].purged_bytes;
+		arena_unlock(&arenas[i]);
+	}
+	return after > before;
+}
+
+static void collect_remote_frees(struct arena *arena);
+
+// pushes a chain of blocks, linked through their first word from first to last, onto another arena's remote stack: one CAS, no lock
+// returns 1 if the arena has no threads left, so nobody would ever collect them and the caller has to (see remote_free())
+static int remote_push(struct arena *arena, void *first, void *last)
+{
+	void *head = atomic_load_explicit(&arena->remote_frees, memory_order_relaxed);
+
+	do {
+		set_link(last, head);
+	} while (!atomic_compare_exchange_weak(&arena->remote_frees, &head, first));
+	// the last thread of the arena drops the count before its final collect, and both sides are sequentially consistent,
+	// so either that collect sees the chain or this load sees the count at zero
+	return !atomic_load(&arena->num_threads);
+}
+
+// releases what waits on the remote stack of an arena without threads under its lock
+// the caller must not hold the lock of any other arena: nothing orders the arena locks against each other
+// (except fork_prepare(), which takes them all in index order), so holding two at once can deadlock
+static void collect_orphaned(struct arena *arena)
+{
+	arena_lock(arena);
+	collect_remote_frees(arena);
+	arena_unlock(arena);
+}
+
+// hands a chain of blocks to another arena; the caller holds no arena lock
+static void remote_free(struct arena *arena, void *first, void *last)
+{
+	if (remote_push(arena, first, last))
+		collect_orphaned(arena);
+}
+
+// releases every block other threads left on the arena's remote stack; caller holds the arena lock
+// the stack is only ever taken whole, so there is no ABA problem with the pushes going on at the same time
+static void collect_remote_frees(struct arena *arena)
+{
+	void *p, *next;
+
+	if (!atomic_load_explicit(&arena->remote_frees, memory_order_relaxed))
+		return;
+	for (p = atomic_exchange(&arena->remote_frees, NULL); p; p = next) {
+		next = get_link(p);
+		release_payload(arena, p);
+		arena->remote_collected++;
+	}
+}
+
+// takes the lock of the calling thread's own arena on a slow path, releasing what other threads freed for it on the way
+static void arena_lock_own(struct arena *arena)
+{
+	arena_lock(arena);
+	collect_remote_frees(arena);
+	maybe_purge(arena);
+}
+
+// gives a single block back to the arena owning it: under the lock if that is the calling thread's arena, else remotely
+static void free_to_arena(struct arena *owner, void *p)
+{
+	if (owner != thread_arena) {
+		remote_free(owner, p, p);
+		return;
+	}
+	arena_lock_own(owner);
+	release_payload(owner, p);
+	arena_unlock(owner);
+}
+
+static void read_conf(void);
+static void install_stats_signal(void);
+static void prof_init(void);
+static void install_prof_signal(void);
+static void trace_init(void);
+static void tcache_limit(void);
+
+// arenas:N in MEMALLOC_CONF, 0 means one per CPU
+static long conf_arenas;
+
+// reads the configuration and sets up one arena per CPU (or as many as configured), runs once before the first allocation
+static void arenas_init(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned i;
+
+	hardening_init();
+	read_conf();
+	tcache_limit();
+	thp_init();
+	if (conf_arenas)
+		cpus = conf_arenas;
+	num_arenas = cpus < 1 ? 1 : cpus > MAX_ARENAS ? MAX_ARENAS : cpus;
+	for (i = 0; i < num_arenas; i++)
+		pthread_mutex_init(&arenas[i].lock, NULL);
+	slab_zone_init();
+	prof_init();
+	trace_init();
+	install_stats_signal();
+	install_prof_signal();
+}
+
+// returns the calling thread's arena, assigning the next one round-robin the first time
+static struct arena *get_arena(void)
+{
+	if (!thread_arena) {
+		pthread_once(&arenas_once, arenas_init);
+		thread_arena = &arenas[atomic_fetch_add(&next_arena, 1) % num_arenas];
+		atomic_fetch_add(&thread_arena->num_threads, 1);
+	}
+	return thread_arena;
+}
+
+// rounds up to whole pages
+static size_t page_round(size_t size)
+{
+	return (size + page_size() - 1) & ~(page_size() - 1);
+}
+
+// where the mapping of a block from map_block() starts, and how long it is
+static char *map_start(header_t *header)
+{
+	return (char*)header - header->s.prev_size;
+}
+
+static size_t map_length(header_t *header)
+{
+	return header->s.prev_size + sizeof(header_t) + header->s.size;
+}
+
+// gives a large request (a multiple of 16) a mapping of its own, no lock needed since nothing shared is touched
+// the payload is aligned to `alignment` (a power of two, at least 16): the mapping is made big enough for that and
+// whatever whole pages end up in front of the header or past the block are unmapped again, so at most a page is lost
+static header_t *map_block(size_t size, size_t alignment)
+{
+	size_t guard = guard_pages ? page_size() : 0;
+	size_t length = page_round(sizeof(header_t) + size + (alignment > SMALL_CLASS_STEP ? alignment : 0)) + guard;
+	char *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	char *payload, *start, *end;
+	header_t *header;
+
+	if (map == MAP_FAILED)
+		return NULL;
+	if (guard) {
+		// the payload ends (as far as its alignment lets it) right where the guard page starts, so running off its end faults
+		end = map + length - guard;
+		if (mprotect(end, guard, PROT_NONE)) {
+			munmap(map, length);
+			return NULL;
+		}
+		payload = (char*)((size_t)(end - size) & ~(alignment - 1));
+	} else {
+		payload = (char*)(((size_t)map + sizeof(header_t) + alignment - 1) & ~(alignment - 1));
+		end = map + page_round(payload + size - map);
+	}
+	start = (char*)(((size_t)payload - sizeof(header_t)) & ~(page_size() - 1));
+	if (start > map)
+		munmap(map, start - map);
+	if (end + guard < map + length)
+		munmap(end + guard, map + length - end - guard);
+	header = (header_t*)payload - 1;
+	header->s.prev_size = (char*)header - start;
+	// the whole mapping past the header is usable, so count the rounding up to a page as part of the block
+	header->s.size = end - payload;
+	header->s.is_mmapped = 1;
+	if ((size_t)(end - start) >= HUGE_PAGE_SIZE)
+		advise_huge(start, end - start);
+	atomic_fetch_add(&mapped_bytes, end - start);
+	atomic_fetch_add(&mapped_blocks, 1);
+	atomic_fetch_add(&mapped_block_bytes, header->s.size);
+	return header;
+}
+
+// gives a block from map_block() back to the OS
+static void unmap_block(header_t *header)
+{
+	atomic_fetch_sub(&mapped_bytes, map_length(header));
+	atomic_fetch_sub(&mapped_blocks, 1);
+	atomic_fetch_sub(&mapped_block_bytes, header->s.size);
+	munmap(map_start(header), map_length(header) + (guard_pages ? page_size() : 0));
+}
+
+// resizes a block from map_block() with mremap(), which lets the kernel move the pages around (if it has to) instead of copying bytes
+// returns the possibly moved block, or NULL (leaving the old one alone) if that failed
+// (the header keeps its offset into the mapping, like realloc() the result is only 16-byte aligned for sure)
+static header_t *remap_block(header_t *header, size_t size)
+{
+	size_t offset = header->s.prev_size;
+	size_t length = page_round(offset + sizeof(header_t) + size);
+	char *moved;
+
+	if (length == map_length(header))
+		return header;
+	// the guard page would end up in the middle (and the payload away from it), so guarded blocks get copied instead
+	if (guard_pages)
+		return NULL;
+	// the old header is gone once the mapping moves, so only the offset saved above is used to find the new one
+	moved = mremap(map_start(header), map_length(header), length, MREMAP_MAYMOVE);
+	if (moved == MAP_FAILED)
+		return NULL;
+	header = (header_t*)(moved + offset);
+	atomic_fetch_add(&mapped_bytes, length - map_length(header));
+	atomic_fetch_add(&mapped_block_bytes, length - map_length(header));
+	header->s.size = length - header->s.prev_size - sizeof(header_t);
+	return header;
+}
+
+// resizes a chunk block (to a multiple of 16) without moving it, returns 1 if that worked
+// shrinking splits the spare tail off, growing swallows the free block right after it (e.g. the rest of a fresh chunk)
+static int resize_block(header_t *header, size_t size)
+{
+	struct arena *arena;
+	header_t *next;
+	int resized = 1;
+
+	// nothing to give back (the leftover would be too small to be a block), so no need to take the lock either
+	if (size <= header->s.size && header->s.size < size + sizeof(header_t) + MIN_BLOCK_SIZE)
+		return 1;
+	arena = arena_of(header);
+	arena_lock(arena);
+	// the block is in use, so none of what it has now can be assumed to be zero any more
+	header->s.zero_from = header->s.size;
+	if (size > header->s.size) {
+		next = next_block(header);
+		if (next->s.is_free && header->s.size + sizeof(header_t) + next->s.size >= size) {
+			remove_free_block(arena, next);
+			header->s.zero_from = header->s.size + sizeof(header_t) + next->s.zero_from;
+			header->s.size += sizeof(header_t) + next->s.size;
+		} else {
+			resized = 0;
+		}
+	}
+	// hand whatever is left over past the new size back to the arena
+	if (resized)
+		split_block(arena, header, size);
+	arena_unlock(arena);
+	return resized;
+}
+
+// tunes the allocator like glibc's mallopt(), only M_MMAP_THRESHOLD is supported (returns 1 on success, 0 otherwise)
+int mallopt(int param, int value)
+{
+	// anything bigger than a chunk can hold has to be mapped on its own anyway
+	if (param != M_MMAP_THRESHOLD || value < 0 || (size_t)value > CHUNK_MAX_BLOCK)
+		return 0;
+	mmap_threshold = value;
+	tcache_limit();
+	return 1;
+}
+
+/*
+   Per-thread caches (like glibc's tcache or the magazines in jemalloc/mimalloc).
+   Each thread keeps a short stack of recently freed blocks for every size class
+   up to tcache_max (32 KB unless MEMALLOC_CONF says otherwise, at most the
+   largest medium class, and only the classes whose requests all stay below
+   the mmap threshold, so those still get a mapping of their own). malloc() and free() on a cached class only touch the
+   calling thread's stack, so they never take an arena lock. Blocks move
+   between a stack and the shared heap in batches under a single lock:
+   - an empty stack is refilled with up to TCACHE_BATCH_BYTES worth of blocks
+   - a stack that grows past TCACHE_BIN_MAX is flushed back down to half of that
+   Cached blocks stay marked as in use, so the shared heap never hands them out.
+   The stacks of the small classes hold objects from slab runs, the others
+   headered blocks, both linked through the first word of their payload.
+ */
+#define DEFAULT_TCACHE_MAX_SHIFT 15				// cache classes up to 32 KB by default
+// every class but the large one can be cached, so that is how many stacks a thread has
+#define TCACHE_NUM_CLASSES LARGE_CLASS
+#define TCACHE_BIN_MAX 32
+#define TCACHE_BATCH_BYTES (64 * 1024)
+
+// the classes below this one are cached (0 turns the thread caches off)
+static unsigned tcache_classes = NUM_SMALL_CLASSES + DEFAULT_TCACHE_MAX_SHIFT - MEDIUM_CLASS_MIN_SHIFT + 1;
+// the classes tcache_max asks for, of which tcache_limit() keeps the ones below the mmap threshold
+static unsigned tcache_max_classes = NUM_SMALL_CLASSES + DEFAULT_TCACHE_MAX_SHIFT - MEDIUM_CLASS_MIN_SHIFT + 1;
+
+// sets tcache_classes from tcache_max and mmap_threshold, whichever is lower wins
+// (a cached class serves every request up to its full size, so one reaching the threshold would keep requests off their own mapping)
+// blocks already cached for a class that drops out stay on their stack until the thread exits
+static void tcache_limit(void)
+{
+	unsigned classes = tcache_max_classes;
+
+	while (classes && class_size(classes - 1) >= mmap_threshold)
+		classes--;
+	tcache_classes = classes;
+}
+
+/*
+   Statistics. Every thread counts its own allocations in its cache struct, so
+   keeping them costs a few adds to memory nobody else writes (no atomic
+   read-modify-write, no shared cache lines). The counters are relaxed atomics
+   only so that a reader summing them up never sees a torn value. Threads sign
+   up in a registry the first time they allocate, and whatever an exiting
+   thread counted is folded into retired_stats. mallinfo2()/malloc_stats() add
+   it all up, and stats_signal:<signal number> in MEMALLOC_CONF dumps the same
+   report whenever the process gets that signal. With stats:0 the threads do
+   not count anything (the arenas still keep their own numbers).
+ */
+// index of the counters for blocks with their own mapping, right after the size classes
+#define MAPPED_CLASS NUM_CLASSES
+
+typedef _Atomic unsigned long long counter_t;
+
+// adds to a counter only the owning thread writes: a plain load and store, but still safe to read from another thread
+#define COUNT(counter, n) atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + (n), memory_order_relaxed)
+#define READ(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+// counts into a thread's own counters, unless stats are off
+#define STAT(counter, n) do { if (stats_enabled) COUNT(counter, n); } while (0)
+
+static int stats_enabled = 1;
+
+struct thread_stats {
+	counter_t allocs[NUM_CLASSES + 1];	// blocks handed out per size class (and with their own mapping)
+	counter_t frees[NUM_CLASSES + 1];	// blocks given back per size class (and with their own mapping)
+	counter_t bytes_allocated;			// payload bytes handed out, including growth through realloc()
+	counter_t bytes_freed;				// payload bytes given back, including shrinking through realloc()
+	counter_t cache_hits;				// cached requests served straight from the thread cache
+	counter_t cache_misses;				// cached requests that had to refill from the arena first
+	counter_t cached_bytes;				// payload bytes sitting in the thread cache (wraps around, only the sum across threads means anything)
+};
+
+// a stack of cached blocks (their payloads) for one size class, each one holding the link to the next in its first word
+struct tcache_bin {
+	void *head;
+	unsigned count;
+};
+
+// states of a thread's cache: set up lazily on first use and switched off for good once the thread exits
+enum { TCACHE_UNINITIALIZED, TCACHE_ACTIVE, TCACHE_DISABLED };
+
+struct tcache {
+	struct tcache_bin bins[TCACHE_NUM_CLASSES];
+	int state;
+	struct thread_stats stats;
+	// heap profiling: bytes left until the next sample, the generator that spaces the samples out, and whether one is being taken
+	long long prof_countdown;
+	unsigned long long prof_rng;
+	int in_prof;
+	// the thread's ring of trace records, once it has traced something
+	struct trace_ring *trace;
+	// links in the registry of live threads (under stats_lock)
+	struct tcache *next;
+	struct tcache *prev;
+};
+
+// __thread gives every thread its own copy; initial-exec keeps the access a single instruction (no __tls_get_addr() call)
+static __thread struct tcache tcache __attribute__((tls_model("initial-exec")));
+// the key is only used for its destructor, which hands the cache back when the thread exits
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+// every live thread's cache (and so its counters), plus the counters of the threads that already exited
+static struct tcache *registry;
+static struct thread_stats retired_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// counts a block (of the given class and size) handed out to, or given back by, the user
+static void count_alloc(struct tcache *tc, unsigned class, size_t size)
+{
+	STAT(tc->stats.allocs[class], 1);
+	STAT(tc->stats.bytes_allocated, size);
+}
+
+static void count_free(struct tcache *tc, unsigned class, size_t size)
+{
+	STAT(tc->stats.frees[class], 1);
+	STAT(tc->stats.bytes_freed, size);
+}
+
+// the class a headered block is counted under
+static unsigned header_class(header_t *header)
+{
+	return header->s.is_mmapped ? MAPPED_CLASS : block_class(header->s.size);
+}
+
+// adds one set of counters to another
+static void add_stats(struct thread_stats *total, struct thread_stats *stats)
+{
+	unsigned class;
+
+	for (class = 0; class <= NUM_CLASSES; class++) {
+		COUNT(total->allocs[class], READ(stats->allocs[class]));
+		COUNT(total->frees[class], READ(stats->frees[class]));
+	}
+	COUNT(total->bytes_allocated, READ(stats->bytes_allocated));
+	COUNT(total->bytes_freed, READ(stats->bytes_freed));
+	COUNT(total->cache_hits, READ(stats->cache_hits));
+	COUNT(total->cache_misses, READ(stats->cache_misses));
+	COUNT(total->cached_bytes, READ(stats->cached_bytes));
+}
+
+// how many blocks of a class move between a thread cache and the shared heap at once
+static unsigned tcache_batch(size_t size)
+{
+	size_t count = TCACHE_BATCH_BYTES / size;
+
+	if (count < 1)
+		return 1;
+	if (count > TCACHE_BIN_MAX / 2)
+		return TCACHE_BIN_MAX / 2;
+	return count;
+}
+
+// returns every cached block past the first `keep` ones to the arenas they belong to
+// only the thread's own arena gets locked (once, unless blocks for an arena without threads make it let go in between),
+// blocks from the same other arena usually sit next to each other and go over as one chain
+static void tcache_flush(struct tcache_bin *bin, unsigned keep)
+{
+	void *curr = bin->head, *prev = NULL, *next, *first, *last;
+	struct arena *locked = NULL, *owner;
+	unsigned i;
+
+	// the blocks at the top of the stack were freed most recently (and are likely still in the CPU cache), so keep those
+	for (i = 0; i < keep && curr; i++) {
+		prev = curr;
+		curr = get_link(curr);
+	}
+	if (prev)
+		set_link(prev, NULL);
+	else
+		bin->head = NULL;
+	bin->count = i;
+	while (curr) {
+		owner = is_slab(curr) ? run_of(curr)->arena : arena_of((header_t*)curr - 1);
+		// a run of blocks from another arena goes over as one chain (they are already linked)
+		if (owner != thread_arena) {
+			first = last = curr;
+			while ((next = get_link(last)) && (is_slab(next) ? run_of(next)->arena : arena_of((header_t*)next - 1)) == owner)
+				last = next;
+			// an arena without threads needs its lock to take them, so let go of ours first (see collect_orphaned())
+			if (remote_push(owner, first, last)) {
+				if (locked) {
+					arena_unlock(locked);
+					locked = NULL;
+				}
+				collect_orphaned(owner);
+			}
+			curr = next;
+			continue;
+		}
+		if (!locked) {
+			arena_lock_own(owner);
+			locked = owner;
+		}
+		next = get_link(curr);
+		release_payload(owner, curr);
+		curr = next;
+	}
+	if (locked)
+		arena_unlock(locked);
+}
+
+// fills an empty stack with a batch of blocks for a class from the thread's arena, taking its lock once
+// small classes take objects from the arena's runs (leaving the stack empty if there is no slab zone)
+// the other classes split the batch off existing free blocks, and only the first block may map a new chunk (whose rest then feeds the others)
+static void tcache_refill(struct tcache_bin *bin, unsigned class)
+{
+	struct arena *arena = get_arena();
+	size_t size = class_size(class);
+	unsigned count = tcache_batch(size);
+	header_t *header;
+	void *obj;
+
+	arena_lock_own(arena);
+	if (class < NUM_SMALL_CLASSES) {
+		while (slab_zone_size && bin->count < count && (obj = slab_alloc(arena, class))) {
+			set_link(obj, bin->head);
+			bin->head = obj;
+			bin->count++;
+		}
+	} else {
+		while (bin->count < count && (header = bin->head ? get_free_block(arena, size) : acquire_block(arena, size))) {
+			touch_links(header);
+			set_link(&links(header)->next, bin->head);
+			bin->head = header + 1;
+			bin->count++;
+		}
+	}
+	arena_unlock(arena);
+}
+
+static void trace_thread_exit(struct tcache *tc);
+
+// hands a thread's cached blocks back to the shared heap when it exits (runs as the tcache_key destructor)
+static void tcache_thread_exit(void *arg)
+{
+	struct tcache *tc = arg;
+	unsigned class;
+
+	// anything the thread still frees from here on (e.g. in other destructors) goes straight back to the shared heap (uncounted)
+	tc->state = TCACHE_DISABLED;
+	for (class = 0; class < TCACHE_NUM_CLASSES; class++) {
+		STAT(tc->stats.cached_bytes, -(unsigned long long)tc->bins[class].count * class_size(class));
+		tcache_flush(&tc->bins[class], 0);
+	}
+	// whatever other threads freed for this arena would otherwise wait for the next slow path of a thread that may never come
+	// (once the count drops, the threads freeing for the arena clean up after themselves if it was the last one)
+	if (thread_arena) {
+		atomic_fetch_sub(&thread_arena->num_threads, 1);
+		arena_lock_own(thread_arena);
+		arena_unlock(thread_arena);
+	}
+	trace_thread_exit(tc);
+	// keep what the thread counted and take it off the registry before its thread-local memory goes away
+	pthread_mutex_lock(&stats_lock);
+	add_stats(&retired_stats, &tc->stats);
+	if (tc->prev)
+		tc->prev->next = tc->next;
+	else
+		registry = tc->next;
+	if (tc->next)
+		tc->next->prev = tc->prev;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void tcache_key_init(void)
+{
+	pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+// returns the calling thread's cache, or NULL if the thread is exiting and no longer caches blocks
+static struct tcache *get_tcache(void)
+{
+	struct tcache *tc = &tcache;
+
+	if (tc->state == TCACHE_ACTIVE)
+		return tc;
+	if (tc->state == TCACHE_DISABLED)
+		return NULL;
+	// first use in this thread: mark it active before registering, in case pthread_setspecific() itself calls malloc()
+	tc->state = TCACHE_ACTIVE;
+	// the configuration has to be in place before the first allocation looks at it
+	pthread_once(&arenas_once, arenas_init);
+	pthread_once(&tcache_key_once, tcache_key_init);
+	pthread_setspecific(tcache_key, tc);
+	pthread_mutex_lock(&stats_lock);
+	tc->next = registry;
+	if (registry)
+		registry->prev = tc;
+	registry = tc;
+	pthread_mutex_unlock(&stats_lock);
+	return tc;
+}
+
+// takes a headered block for a request that does not come from a thread cache or a slab run
+// the size only gets rounded up to 16 bytes, since whatever a block has left over is split off and reused
+static header_t *allocate_block(size_t size)
+{
+	struct arena *arena;
+	header_t *header;
+
+	size = ROUND_UP(size);
+	// requests past the threshold get a mapping of their own (without taking the lock)
+	if (size >= mmap_threshold || size > CHUNK_MAX_BLOCK)
+		return map_block(size, SMALL_CLASS_STEP);
+	// only one thread can access an arena when operating on critical code like manipulating list, so we lock it
+	arena = get_arena();
+	arena_lock_own(arena);
+	header = acquire_block(arena, size);
+	arena_unlock(arena);		// unlock after the list manipulation
+	return header;
+}
+
+/*
+   Heap profiling. With prof_sample:N in MEMALLOC_CONF about one allocation per
+   N bytes gets sampled: the stack that asked for it goes into a table of
+   stacks and the block into a table of live samples until it is freed, and
+   memalloc_prof_dump() (or the prof_signal) writes them out as a heap profile
+   pprof reads. The gaps between samples are drawn from an exponential
+   distribution with mean N, like tcmalloc and jemalloc do, so every byte has
+   the same chance to be picked and pprof can scale the samples back up.
+   All the fast path pays is a countdown of the bytes to the thread's next
+   sample, and with profiling off that starts out too high to ever run out.
+   A sampled block always gets a header (slab objects have none to mark it
+   with), so free() only goes to the live samples for blocks that are in there.
+   Both tables are mapped once at a fixed size; samples that do not fit are
+   dropped, and counted as such in the profile.
+ */
+#define PROF_MAX_DEPTH 64
+#define PROF_STACKS 4096				// a power of two
+#define PROF_SAMPLES 65536				// a power of two
+
+// a distinct stack, with the sampled blocks it allocated (still live, and ever)
+struct prof_stack {
+	unsigned long hash;					// 0 while the slot is unused
+	unsigned depth;
+	void *pcs[PROF_MAX_DEPTH];
+	size_t live_count;
+	size_t live_bytes;
+	size_t alloc_count;
+	size_t alloc_bytes;
+};
+
+// a sampled block that is still live
+struct prof_sample {
+	void *block;						// NULL while the slot is unused
+	size_t size;						// the size that was asked for
+	struct prof_stack *stack;
+};
+
+// mean number of bytes between two samples, 0 while profiling is off
+static size_t prof_sample_bytes;
+static struct prof_stack *prof_stacks;
+static struct prof_sample *prof_samples;
+static size_t prof_live;
+static size_t prof_dropped;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// maps the tables if MEMALLOC_CONF turned profiling on (the pages only get touched as they fill up)
+static void prof_init(void)
+{
+	size_t length = PROF_STACKS * sizeof(struct prof_stack) + PROF_SAMPLES * sizeof(struct prof_sample);
+	char *map;
+
+	if (!prof_sample_bytes)
+		return;
+	map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (map == MAP_FAILED) {
+		prof_sample_bytes = 0;
+		return;
+	}
+	prof_stacks = (struct prof_stack*)map;
+	prof_samples = (struct prof_sample*)(map + PROF_STACKS * sizeof(struct prof_stack));
+}
+
+// natural log of x in (0, 1], close enough for spacing samples out without pulling in libm
+static double prof_log(double x)
+{
+	double y, y2;
+	int e = 0;
+
+	while (x < 0.5) {
+		x *= 2;
+		e--;
+	}
+	// ln(x) = 2 * atanh((x - 1) / (x + 1)) and the series converges fast for |y| <= 1/3
+	y = (x - 1) / (x + 1);
+	y2 = y * y;
+	return e * 0.69314718055994531 + 2 * y * (1 + y2 * (1.0 / 3 + y2 * (1.0 / 5 + y2 * (1.0 / 7 + y2 * (1.0 / 9 + y2 / 11)))));
+}
+
+// draws the number of bytes until the thread's next sample
+static long long prof_interval(struct tcache *tc)
+{
+	unsigned long long x = tc->prof_rng;
+	double u;
+
+	// xorshift64*, seeded from the thread's own address so threads do not sample in lockstep
+	if (!x)
+		x = (unsigned long long)(size_t)tc * 0x9e3779b97f4a7c15ULL | 1;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	tc->prof_rng = x;
+	// 53 random bits make a uniform u in (0, 1], and -ln(u) * mean an exponential gap with that mean
+	u = (((x * 0x2545f4914f6cdd1dULL) >> 11) + 1.0) / 9007199254740992.0;
+	return (long long)(-prof_log(u) * prof_sample_bytes) + 1;
+}
+
+// called when a thread's countdown ran out: starts the next one and says whether to sample the allocation that ended it
+static int prof_due(struct tcache *tc)
+{
+	if (!prof_sample_bytes) {
+		tc->prof_countdown = (long long)((unsigned long long)-1 >> 1);
+		return 0;
+	}
+	tc->prof_countdown = prof_interval(tc);
+	// whatever backtrace() allocates while a sample is being taken is not sampled itself
+	return !tc->in_prof;
+}
+
+// where a block would sit in the table of live samples
+static size_t prof_slot(void *block)
+{
+	return ((size_t)block >> 4) * 0x9e3779b97f4a7c15ULL >> 16 & (PROF_SAMPLES - 1);
+}
+
+// adds a live sample for the block under the given stack, returns 0 if it had to be dropped
+static int prof_record(void *block, size_t size, void **pcs, unsigned depth)
+{
+	struct prof_stack *stack = NULL;
+	unsigned long hash = 14695981039346656037UL;
+	size_t i, probes;
+
+	for (i = 0; i < depth; i++)
+		hash = (hash ^ (size_t)pcs[i]) * 1099511628211UL;
+	hash |= 1;
+	pthread_mutex_lock(&prof_lock);
+	for (i = hash, probes = 0; probes < PROF_STACKS; i++, probes++) {
+		stack = &prof_stacks[i & (PROF_STACKS - 1)];
+		if (!stack->hash) {
+			stack->hash = hash;
+			stack->depth = depth;
+			memcpy(stack->pcs, pcs, depth * sizeof(void*));
+			break;
+		}
+		if (stack->hash == hash && stack->depth == depth && !memcmp(stack->pcs, pcs, depth * sizeof(void*)))
+			break;
+	}
+	// one slot always stays empty, so looking up a block that is not in there stops
+	if (probes == PROF_STACKS || prof_live == PROF_SAMPLES - 1) {
+		prof_dropped++;
+		pthread_mutex_unlock(&prof_lock);
+		return 0;
+	}
+	for (i = prof_slot(block); prof_samples[i].block; i = (i + 1) & (PROF_SAMPLES - 1))
+		;
+	prof_samples[i].block = block;
+	prof_samples[i].size = size;
+	prof_samples[i].stack = stack;
+	prof_live++;
+	stack->live_count++;
+	stack->live_bytes += size;
+	stack->alloc_count++;
+	stack->alloc_bytes += size;
+	pthread_mutex_unlock(&prof_lock);
+	return 1;
+}
+
+// takes a freed block out of the live samples
+static void prof_forget(void *block)
+{
+	struct prof_sample *sample;
+	size_t i, j, home;
+
+	pthread_mutex_lock(&prof_lock);
+	for (i = prof_slot(block); prof_samples[i].block != block; i = (i + 1) & (PROF_SAMPLES - 1)) {
+		if (!prof_samples[i].block) {
+			pthread_mutex_unlock(&prof_lock);
+			return;
+		}
+	}
+	sample = &prof_samples[i];
+	sample->stack->live_count--;
+	sample->stack->live_bytes -= sample->size;
+	prof_live--;
+	// close the gap by moving back every later entry of the run that may not sit in front of its slot,
+	// so the lookups for them still find them without any tombstones
+	for (j = (i + 1) & (PROF_SAMPLES - 1); prof_samples[j].block; j = (j + 1) & (PROF_SAMPLES - 1)) {
+		home = prof_slot(prof_samples[j].block);
+		if (((j - home) & (PROF_SAMPLES - 1)) >= ((j - i) & (PROF_SAMPLES - 1))) {
+			prof_samples[i] = prof_samples[j];
+			i = j;
+		}
+	}
+	prof_samples[i].block = NULL;
+	pthread_mutex_unlock(&prof_lock);
+}
+
+// takes a sampled allocation: a headered block like any bigger request gets, recorded with the stack that asked for it
+static void *prof_allocate(struct tcache *tc, size_t size)
+{
+	void *pcs[PROF_MAX_DEPTH + 1];
+	header_t *header;
+	int depth;
+
+	// backtrace() can allocate itself (its first call loads libgcc_s)
+	tc->in_prof = 1;
+	depth = backtrace(pcs, PROF_MAX_DEPTH + 1);
+	tc->in_prof = 0;
+	if (!(header = allocate_block(size)))
+		return NULL;
+	count_alloc(tc, header_class(header), header->s.size);
+	// the first frame is this function (pprof cuts the rest of the allocator's frames off by their names)
+	if (depth > 0 && prof_record(header + 1, size, pcs + 1, depth - 1))
+		header->s.is_sampled = 1;
+	seal_header(header);
+	return (void*)(header + 1);
+}
+
+/*
+   Tracing. With trace:PATH in MEMALLOC_CONF every malloc(), calloc(),
+   realloc() and free() (and the aligned, sized, bulk and C++ versions) ends
+   up in PATH.<pid>.trace as a 32-byte record: what was done, the size asked
+   for, the block's address as its pointer id (replay.c maps those to blocks
+   of its own), the thread's number and a CLOCK_MONOTONIC timestamp. Only
+   calls that got a block are recorded, since a failed one changes nothing.
+   Every thread writes its records into a ring of its own without any lock:
+   only the thread moves the head and only a flush moves the tail, so each
+   side just publishes its index with a release store. Once the ring is half
+   full the thread writes it out with one write() (under trace_lock, which
+   only flushes take), and whatever is left gets flushed when the thread
+   exits and when the program does. The file holds each thread's records in
+   order, interleaved in chunks with the other threads', and the replay sorts
+   them by time. A free is recorded before the block is handed back and an
+   allocation after it was taken, so a block that another thread gets right
+   away shows up freed before it is allocated again. (Not so for the old
+   block of a realloc() that moves, which is given back inside the call:
+   the replay takes an allocation at a live address as that block's free.)
+ */
+#define TRACE_MAGIC "MEMTRACE"
+#define TRACE_VERSION 1
+// records in each thread's ring (256 KB)
+#define TRACE_RING_RECORDS 8192
+// sizes are stored in 40 bits, anything bigger (it could only have failed anyway) is cut down to this
+#define TRACE_MAX_SIZE ((1ULL << 40) - 1)
+// thread number of the records written by threads that are exiting and have no ring any more
+#define TRACE_NO_THREAD ((1U << 20) - 1)
+
+enum { TRACE_MALLOC = 1, TRACE_CALLOC, TRACE_REALLOC, TRACE_FREE, TRACE_MEMALIGN };
+
+// what the file starts with
+struct trace_header {
+	char magic[8];
+	unsigned version;
+	unsigned record_size;
+};
+
+struct trace_record {
+	unsigned long long time;			// CLOCK_MONOTONIC in nanoseconds
+	unsigned long long ptr;				// the block allocated, or the one freed
+	unsigned long long arg;				// realloc(): the block it was given (0 for NULL), memalign(): the alignment
+	unsigned long long size : 40;		// bytes asked for (calloc(): num * size), 0 for free()
+	unsigned long long thread : 20;		// threads are numbered in the order they first allocate
+	unsigned long long op : 4;			// TRACE_*
+};
+
+struct trace_ring {
+	struct trace_record records[TRACE_RING_RECORDS];
+	_Atomic size_t head;				// records the thread has put in (only the thread moves it)
+	_Atomic size_t tail;				// records written out (only moved under trace_lock)
+	unsigned thread;
+	int in_use;							// a live thread has it (the rings of exited threads get reused)
+	struct trace_ring *next;			// every ring, for the flush at exit
+};
+
+static char trace_prefix[256];
+static int trace_fd = -1;
+// set once the exit flush is done: anything after it goes straight to the file
+static int trace_exited;
+static struct trace_ring *trace_rings;
+static unsigned trace_threads;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void trace_open(void);
+
+static void trace_write(const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len && (n = write(trace_fd, buf, len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf = (const char*)buf + n;
+		len -= n;
+	}
+}
+
+// writes out everything in a ring so far; caller holds trace_lock
+static void trace_drain(struct trace_ring *ring)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t first = tail % TRACE_RING_RECORDS, count = head - tail;
+
+	// at most two pieces: up to the end of the ring, and from its start
+	if (first + count > TRACE_RING_RECORDS) {
+		trace_write(&ring->records[first], (TRACE_RING_RECORDS - first) * sizeof(struct trace_record));
+		count -= TRACE_RING_RECORDS - first;
+		first = 0;
+	}
+	trace_write(&ring->records[first], count * sizeof(struct trace_record));
+	atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
+
+// gives the thread a ring: one left behind by a thread that exited, or a new mapping
+static struct trace_ring *trace_ring_get(struct tcache *tc)
+{
+	struct trace_ring *ring;
+	void *map;
+
+	pthread_mutex_lock(&trace_lock);
+	for (ring = trace_rings; ring && ring->in_use; ring = ring->next)
+		;
+	if (!ring && (map = mmap(NULL, sizeof(struct trace_ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+		ring = map;
+		ring->next = trace_rings;
+		trace_rings = ring;
+	}
+	if (ring) {
+		ring->in_use = 1;
+		ring->thread = trace_threads < TRACE_NO_THREAD ? trace_threads++ : TRACE_NO_THREAD;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	tc->trace = ring;
+	return ring;
+}
+
+// appends one record to the calling thread's ring, flushing it when it is half full
+static void trace(unsigned op, void *ptr, size_t size, size_t arg)
+{
+	struct trace_record record;
+	struct trace_ring *ring = NULL;
+	struct tcache *tc;
+	struct timespec ts;
+	size_t head, tail;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	record.time = (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	record.ptr = (size_t)ptr;
+	record.arg = arg;
+	record.size = size < TRACE_MAX_SIZE ? size : TRACE_MAX_SIZE;
+	record.op = op;
+	if (!trace_exited && (tc = get_tcache()))
+		ring = tc->trace ? tc->trace : trace_ring_get(tc);
+	if (!ring) {
+		// an exiting thread (or no memory for a ring): straight to the file
+		record.thread = TRACE_NO_THREAD;
+		pthread_mutex_lock(&trace_lock);
+		trace_write(&record, sizeof(record));
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+	record.thread = ring->thread;
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	// full: the thread's own flush must have found trace_lock busy every time, so wait for it now
+	if (head - tail == TRACE_RING_RECORDS) {
+		pthread_mutex_lock(&trace_lock);
+		trace_drain(ring);
+		pthread_mutex_unlock(&trace_lock);
+		tail = head;
+	}
+	ring->records[head % TRACE_RING_RECORDS] = record;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	if (head + 1 - tail >= TRACE_RING_RECORDS / 2 && !pthread_mutex_trylock(&trace_lock)) {
+		trace_drain(ring);
+		pthread_mutex_unlock(&trace_lock);
+	}
+}
+
+// records an allocation that got a block and hands the block through (return traced(TRACE_MALLOC, allocate(size), size, 0))
+static void *traced(unsigned op, void *block, size_t size, size_t arg)
+{
+	if (trace_fd >= 0 && block)
+		trace(op, block, size, arg);
+	return block;
+}
+
+// records a free, before the block is given back
+static void trace_free(void *block)
+{
+	if (trace_fd >= 0 && block)
+		trace(TRACE_FREE, block, 0, 0);
+}
+
+// writes out an exiting thread's ring and leaves it for the next new thread (runs from tcache_thread_exit())
+static void trace_thread_exit(struct tcache *tc)
+{
+	if (!tc->trace)
+		return;
+	pthread_mutex_lock(&trace_lock);
+	trace_drain(tc->trace);
+	tc->trace->in_use = 0;
+	pthread_mutex_unlock(&trace_lock);
+	tc->trace = NULL;
+}
+
+// writes out every ring when the program exits
+__attribute__((destructor)) static void trace_exit(void)
+{
+	struct trace_ring *ring;
+
+	if (trace_fd < 0)
+		return;
+	pthread_mutex_lock(&trace_lock);
+	trace_exited = 1;
+	for (ring = trace_rings; ring; ring = ring->next)
+		trace_drain(ring);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+// a forked child gets a trace file of its own, and the records it inherited are the parent's to write
+static void trace_fork_child(void)
+{
+	struct trace_ring *ring;
+
+	pthread_mutex_init(&trace_lock, NULL);
+	if (trace_fd < 0)
+		return;
+	for (ring = trace_rings; ring; ring = ring->next) {
+		atomic_store(&ring->tail, atomic_load(&ring->head));
+		ring->in_use = ring == tcache.trace;
+	}
+	close(trace_fd);
+	trace_fd = -1;
+	trace_open();
+}
+
+/*
+   Fork. A child starts out with a copy of the whole heap but only the thread
+   that called fork(), so any lock another thread held at that moment would
+   stay locked in it forever. The prepare handler therefore takes every lock
+   of the allocator (the arenas in order, then the registry, the profiler and
+   the trace) so no other thread is halfway through changing what they
+   protect, the parent just lets go of them again, and the child sets them up
+   from scratch. Taking them all in one order is only safe because nothing
+   else ever holds two of them: the rest of the allocator takes at most one
+   arena lock at a time (a cache flush lets go of its own before it collects
+   for an arena without threads, see collect_orphaned()), and the other three
+   are taken with no arena lock held and never around each other. Code that
+   needs another lock while holding one has to keep to this order too.
+   The other threads are gone in the child, but their caches are still in its
+   copy of their thread-local memory: the child hands those blocks back to the
+   arenas and folds the counters of those threads into the retired ones. It
+   also resets the thread counts of the arenas, so the frees for an arena
+   that nobody uses any more are not left waiting on its remote stack.
+ */
+static void fork_prepare(void)
+{
+	unsigned i;
+
+	// the same order as everywhere else: arenas by index, and every one of them before the locks that are not arenas
+	for (i = 0; i < num_arenas; i++)
+		pthread_mutex_lock(&arenas[i].lock);
+	pthread_mutex_lock(&stats_lock);
+	pthread_mutex_lock(&prof_lock);
+	pthread_mutex_lock(&trace_lock);
+}
+
+static void fork_parent(void)
+{
+	unsigned i;
+
+	pthread_mutex_unlock(&trace_lock);
+	pthread_mutex_unlock(&prof_lock);
+	pthread_mutex_unlock(&stats_lock);
+	for (i = num_arenas; i-- > 0;)
+		pthread_mutex_unlock(&arenas[i].lock);
+}
+
+static void fork_child(void)
+{
+	struct tcache *tc, *next;
+	unsigned i, class;
+
+	trace_fork_child();
+	pthread_mutex_init(&prof_lock, NULL);
+	pthread_mutex_init(&stats_lock, NULL);
+	for (i = 0; i < num_arenas; i++) {
+		pthread_mutex_init(&arenas[i].lock, NULL);
+		atomic_store(&arenas[i].num_threads, 0);
+	}
+	if (thread_arena)
+		atomic_store(&thread_arena->num_threads, 1);
+	for (tc = registry; tc; tc = next) {
+		next = tc->next;
+		if (tc == &tcache)
+			continue;
+		for (class = 0; class < TCACHE_NUM_CLASSES; class++) {
+			STAT(tc->stats.cached_bytes, -(unsigned long long)tc->bins[class].count * class_size(class));
+			tcache_flush(&tc->bins[class], 0);
+		}
+		add_stats(&retired_stats, &tc->stats);
+		if (tc->prev)
+			tc->prev->next = tc->next;
+		else
+			registry = tc->next;
+		if (tc->next)
+			tc->next->prev = tc->prev;
+	}
+}
+
+// registers the fork handlers when the library is loaded, since pthread_atfork() is better not called from inside malloc()
+__attribute__((constructor)) static void fork_init(void)
+{
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+// does the work of free(); the functions that free a block on the way (realloc(), the sized and bulk frees) call this
+// instead of free(), so a trace records them once
+static void release(void *block)
+{
+	header_t *header;
+	struct tcache *tc;
+	struct tcache_bin *bin;
+	struct run *run;
+	unsigned class;
+	
+	// edge case: if block is null then just return
+	if (!block)
+		return;
+	tc = get_tcache();
+	// a small object has no header, its run says what it is
+	if (is_slab(block)) {
+		check_slab(block);
+		run = run_of(block);
+		class = run->class;
+		if (tc)
+			count_free(tc, class, run->size);
+		if (tc && class < tcache_classes) {
+			STAT(tc->stats.cached_bytes, run->size);
+			bin = &tc->bins[class];
+			((struct slab_free*)block)->mark = slab_mark(run);
+			set_link(block, bin->head);
+			bin->head = block;
+			if (++bin->count > TCACHE_BIN_MAX) {
+				STAT(tc->stats.cached_bytes, -(unsigned long long)(TCACHE_BIN_MAX + 1 - TCACHE_BIN_MAX / 2) * run->size);
+				tcache_flush(bin, TCACHE_BIN_MAX / 2);
+			}
+			return;
+		}
+		free_to_arena(run->arena, block);
+		return;
+	}
+	header = (header_t*)block - 1;						// get the header of the block (by casting block to header_t, then subtracting it by 1 which moves ptr back by size of header_t, effectively pointing to header)
+	check_header(header, 1);
+	if (tc)
+		count_free(tc, header_class(header), header->s.size);
+	if (header->s.is_sampled) {
+		header->s.is_sampled = 0;
+		prof_forget(block);
+	}
+	// a block with its own mapping goes straight back to the OS
+	if (header->s.is_mmapped) {
+		unmap_block(header);
+		return;
+	}
+	// whatever the user did with the block, none of it can be assumed to be zero any more
+	header->s.zero_from = header->s.size;
+	class = block_class(header->s.size);
+	// fast path: push cached blocks onto this thread's cache without taking any lock
+	// (a headered block of a small class, e.g. what is left of a shrunk one, does not belong on those stacks of slab objects)
+	if (class >= NUM_SMALL_CLASSES && class < tcache_classes && tc) {
+		STAT(tc->stats.cached_bytes, class_size(class));
+		bin = &tc->bins[class];
+		set_link(&links(header)->next, bin->head);
+		bin->head = block;
+		// if the cache got too big, hand half of it back to the shared heap in one go
+		if (++bin->count > TCACHE_BIN_MAX) {
+			STAT(tc->stats.cached_bytes, -(unsigned long long)(TCACHE_BIN_MAX + 1 - TCACHE_BIN_MAX / 2) * class_size(class));
+			tcache_flush(bin, TCACHE_BIN_MAX / 2);
+		}
+		return;
+	}
+	// everything else goes back to the arena that owns it, whichever thread that is (without its lock if it is not ours)
+	free_to_arena(arena_of(header), block);
+}
+
+// the free implementation that takes a void ptr (returned by other functions) to the memory block
+void free(void *block)
+{
+	trace_free(block);
+	release(block);
+}
+
+// does the work of malloc(); calloc() and realloc() call this instead of malloc() directly, because the compiler
+// knows what malloc() means and would otherwise happily turn calloc()'s malloc() + memset() back into a call to calloc()
+static void *allocate(size_t size)
+{
+	// useful to also bookkeep info about each blocks header (is memblock free or not, etc.)
+	header_t *header;
+	struct arena *arena;
+	struct tcache *tc;
+	struct tcache_bin *bin;
+	unsigned class;
+	void *block;
+	// edge case: check if size = 0 (or too big to round up without overflowing), if so, return null ptr
+	if (!size || size > ((size_t)-1 >> 1))
+		return NULL;
+	class = size_class(size);
+	tc = get_tcache();
+	// a sample is taken whenever the thread's countdown runs out, which with profiling off it never does
+	if (tc && (tc->prof_countdown -= size) < 0 && prof_due(tc))
+		return prof_allocate(tc, size);
+	// fast path: pop a block from this thread's cache, and only go to the shared heap (once per batch) when it is empty
+	// cached requests are rounded up to the full size of their class, so every block on a stack can serve any of them
+	if (class < tcache_classes && tc) {
+		bin = &tc->bins[class];
+		if (bin->head) {
+			STAT(tc->stats.cache_hits, 1);
+		} else {
+			STAT(tc->stats.cache_misses, 1);
+			tcache_refill(bin, class);
+			STAT(tc->stats.cached_bytes, (unsigned long long)bin->count * class_size(class));
+		}
+		if ((block = bin->head)) {
+			bin->head = get_link(block);
+			bin->count--;
+			STAT(tc->stats.cached_bytes, -(unsigned long long)class_size(class));
+			count_alloc(tc, class, class_size(class));
+			// a slab object loses its free mark, a headered block already has its header in front of the returned payload
+			if (class < NUM_SMALL_CLASSES)
+				((struct slab_free*)block)->mark = 0;
+			else
+				seal_header((header_t*)block - 1);
+			return block;
+		}
+		// out of memory, unless this is a small request without slab runs to take it (which falls back to a headered block)
+		if (class >= NUM_SMALL_CLASSES)
+			return NULL;
+	} else if (class < NUM_SMALL_CLASSES && slab_zone_size) {
+		// no thread cache (the thread is exiting, or the class is not cached): take an object straight from the arena's runs
+		arena = get_arena();
+		arena_lock_own(arena);
+		block = slab_alloc(arena, class);
+		arena_unlock(arena);
+		if (block)
+			return block;
+	}
+	header = allocate_block(size);
+	// if memory allocation fails, return null ptr
+	if (!header)
+		return NULL;
+	if (tc)
+		count_alloc(tc, header_class(header), header->s.size);
+	seal_header(header);
+	// get memblock location, then cast it to void ptr and return it
+	return (void*)(header + 1);
+}
+
+// given size, returns void ptr to same size allocated memory in heap
+void *malloc(size_t size)
+{
+	return traced(TRACE_MALLOC, allocate(size), size, 0);
+}
+
+// does the work of calloc()
+static void *allocate_zeroed(size_t num, size_t nsize)
+{
+	// total size for memblock
+	size_t size;
+	// raw memory ptr
+	void *block;
+	// header of the block, to see how much of it is known to be zero already
+	header_t *header;
+	// edge case: if either parameters given are 0 then return NULL
+	if (!num || !nsize)
+		return NULL;
+	// calculating total size for memblock
+	size = num * nsize;
+	/* check mul overflow */
+	if (nsize != size / num)
+		return NULL;
+	// do the job of malloc() first
+	block = allocate(size);
+	// if malloc() fails, return NULL ptr
+	if (!block)
+		return NULL;
+	// a small object has no zero tracking, but is at most 256 bytes anyway
+	if (is_slab(block)) {
+		memset(block, 0, size);
+		return block;
+	}
+	header = (header_t*)block - 1;
+	// a block with its own mapping is made of fresh pages that are zero already, so leave them alone (and untouched, keeping RSS down)
+	if (header->s.is_mmapped)
+		return block;
+	// then if malloc() does its job, fill the part of the block that is not known to be zero with 0's using memset()
+	// (for a block fresh out of a chunk that is just the free list links, recycled blocks get glibc's vectorized memset())
+	memset(block, 0, header->s.zero_from < size ? header->s.zero_from : size);
+	// return the pointer to that memory block
+	// we do not have to mess with header of memblock, malloc() does it for us
+	return block;
+}
+
+// given # of elements and type size, does the job of malloc() except sets/initializes memory to 0
+void *calloc(size_t num, size_t nsize)
+{
+	return traced(TRACE_CALLOC, allocate_zeroed(num, nsize), num * nsize, 0);
+}
+
+// does the work of realloc()
+static void *reallocate(void *block, size_t size)
+{
+	// for pointing to the header of a memblock
+	header_t *header;
+	// the moved block when mremap() is used
+	header_t *moved;
+	// the header as it was before resizing, so a resize in place can be counted as a free of the old size and an allocation of the new one
+	header_t old;
+	struct tcache *tc;
+	// readjusted raw memory ptr 
+	void *ret;
+	// edge case: if either block is NULL or size is 0, defer to malloc() (would return NULL ptr ideally)
+	if (!block || !size)
+		return allocate(size);
+	// edge case: too big to round up without overflowing
+	if (size > ((size_t)-1 >> 1))
+		return NULL;
+	// a small object stays where it is as long as the new size maps to the same class, otherwise it moves
+	if (is_slab(block)) {
+		check_slab(block);
+		if (size_class(size) == run_of(block)->class)
+			return block;
+		ret = allocate(size);
+		if (ret) {
+			memcpy(ret, block, run_of(block)->size < size ? run_of(block)->size : size);
+			release(block);
+		}
+		return ret;
+	}
+	// to get header portion of block (casts it so that it points to header_t type, then moves ptr back by the size of header_t to get header location)
+	header = (header_t*)block - 1;
+	check_header(header, 0);
+	old = *header;
+	moved = NULL;
+	// a sampled block always moves, so the profile sees the old one freed and the new one (maybe) sampled
+	if (!header->s.is_sampled) {
+		if (header->s.is_mmapped) {
+			// a block that still belongs in its own mapping is grown (or shrunk) by the kernel, so no bytes get copied
+			if (ROUND_UP(size) >= mmap_threshold)
+				moved = remap_block(header, ROUND_UP(size));
+		} else if (ROUND_UP(size) < mmap_threshold && ROUND_UP(size) <= CHUNK_MAX_BLOCK) {
+			// try to resize the block where it is: this covers every shrink and any growth into a free neighbour,
+			// so a buffer that keeps growing at the end of the heap never gets copied
+			if (resize_block(header, ROUND_UP(size)))
+				moved = header;
+		}
+	}
+	if (moved) {
+		if ((tc = get_tcache())) {
+			count_free(tc, header_class(&old), old.s.size);
+			count_alloc(tc, header_class(moved), moved->s.size);
+		}
+		seal_header(moved);
+		return (void*)(moved + 1);
+	}
+	// if block can't be resized in place, we will malloc() another block with requested size
+	ret = allocate(size);
+	// if mallocated memory for new block successfull
+	if (ret) {
+		// Relocate contents from the old block to the new block using memcpy() (only as much as fits if it shrank)
+		memcpy(ret, block, header->s.size < size ? header->s.size : size);
+		// Then free the old memory block 
+		release(block);
+	}
+	// return resized ptr to memblock
+	return ret;
+}
+
+// for resizing memory allocations (a trace records the block it was given along with the one it returns)
+void *realloc(void *block, size_t size)
+{
+	return traced(TRACE_REALLOC, reallocate(block, size), size, (size_t)block);
+}
+
+/*
+   Bulk allocation. memalloc_bulk() hands out count blocks of one size in a
+   single call: first whatever the thread cache holds for the class, then the
+   rest straight from the thread's arena under one lock, instead of one trip
+   through malloc() (and maybe the lock) per block. Small objects come off the
+   arena's runs, which hand out the objects of one run next to each other, and
+   bigger blocks are cut back to back out of one big block, so they split off
+   the free lists once per batch and share pages and cache lines.
+   memalloc_bulk_free() puts blocks back on the thread cache and trims every
+   bin that overflowed once at the end, so it takes the lock at most once per
+   size class. Anything that does not go through the cache is simply freed.
+ */
+// fills ptrs with up to count blocks of size bytes each, returns how many it got (fewer than count only when out of memory)
+size_t memalloc_bulk(size_t size, size_t count, void **ptrs)
+{
+	struct tcache *tc;
+	struct tcache_bin *bin;
+	struct arena *arena;
+	header_t *header, *rest;
+	size_t n = 0, block_size, stride, batch, i;
+	unsigned class;
+	void *obj;
+
+	if (!size || !count || size > ((size_t)-1 >> 1) / count)
+		return 0;
+	class = size_class(size);
+	tc = get_tcache();
+	if (tc && (tc->prof_countdown -= size * count) < 0 && prof_due(tc)) {
+		if (!(ptrs[n] = prof_allocate(tc, size)))
+			return 0;
+		n++;
+	}
+	if (class < tcache_classes && tc) {
+		bin = &tc->bins[class];
+		for (; n < count && (obj = bin->head); n++) {
+			bin->head = get_link(obj);
+			bin->count--;
+			STAT(tc->stats.cache_hits, 1);
+			STAT(tc->stats.cached_bytes, -(unsigned long long)class_size(class));
+			count_alloc(tc, class, class_size(class));
+			if (class < NUM_SMALL_CLASSES)
+				((struct slab_free*)obj)->mark = 0;
+			else
+				seal_header((header_t*)obj - 1);
+			ptrs[n] = obj;
+		}
+	}
+	// cached classes are rounded up to their class size like the cache does, so the blocks can go back there when freed
+	block_size = class < tcache_classes ? class_size(class) : ROUND_UP(size);
+	if (n < count && tc && (class < NUM_SMALL_CLASSES ? slab_zone_size != 0 : block_size < mmap_threshold && block_size <= CHUNK_MAX_BLOCK)) {
+		arena = get_arena();
+		arena_lock_own(arena);
+		if (class < NUM_SMALL_CLASSES) {
+			for (; n < count && (obj = slab_alloc(arena, class)); n++) {
+				count_alloc(tc, class, class_size(class));
+				ptrs[n] = obj;
+			}
+		} else {
+			stride = sizeof(header_t) + block_size;
+			while (n < count) {
+				batch = count - n;
+				if (batch > CHUNK_MAX_BLOCK / stride)
+					batch = CHUNK_MAX_BLOCK / stride ? CHUNK_MAX_BLOCK / stride : 1;
+				if (!(header = acquire_block(arena, batch * stride - sizeof(header_t))))
+					break;
+				// the block has room for the whole batch, so each cut leaves the next block right behind it
+				for (; batch > 1 && (rest = cut_block(header, block_size)); batch--) {
+					count_alloc(tc, header_class(header), header->s.size);
+					seal_header(header);
+					ptrs[n++] = header + 1;
+					header = rest;
+				}
+				split_block(arena, header, block_size);
+				count_alloc(tc, header_class(header), header->s.size);
+				seal_header(header);
+				ptrs[n++] = header + 1;
+			}
+		}
+		arena_unlock(arena);
+	}
+	// whatever is left (blocks with their own mapping, small ones without slab runs, or after running out) one at a time
+	for (; n < count && (ptrs[n] = allocate(size)); n++)
+		;
+	for (i = 0; trace_fd >= 0 && i < n; i++)
+		traced(TRACE_MALLOC, ptrs[i], size, 0);
+	return n;
+}
+
+// frees count blocks (NULL entries are skipped), typically ones from memalloc_bulk()
+void memalloc_bulk_free(void **ptrs, size_t count)
+{
+	struct tcache *tc = get_tcache();
+	struct tcache_bin *bin;
+	header_t *header;
+	unsigned class;
+	size_t i;
+	void *block;
+
+	for (i = 0; i < count; i++) {
+		if (!(block = ptrs[i]))
+			continue;
+		trace_free(block);
+		if (!tc) {
+			release(block);
+			continue;
+		}
+		if (is_slab(block)) {
+			check_slab(block);
+			if ((class = run_of(block)->class) >= tcache_classes) {
+				release(block);
+				continue;
+			}
+			((struct slab_free*)block)->mark = slab_mark(run_of(block));
+		} else {
+			header = (header_t*)block - 1;
+			class = block_class(header->s.size);
+			if (header->s.is_mmapped || header->s.is_sampled || class < NUM_SMALL_CLASSES || class >= tcache_classes) {
+				release(block);
+				continue;
+			}
+			check_header(header, 1);
+			header->s.zero_from = header->s.size;
+			count_free(tc, class, header->s.size);
+		}
+		if (class < NUM_SMALL_CLASSES)
+			count_free(tc, class, class_size(class));
+		STAT(tc->stats.cached_bytes, class_size(class));
+		bin = &tc->bins[class];
+		set_link(block, bin->head);
+		bin->head = block;
+		bin->count++;
+	}
+	// the bins get trimmed once at the end instead of every time one overflows
+	for (class = 0; tc && class < tcache_classes; class++) {
+		bin = &tc->bins[class];
+		if (bin->count > TCACHE_BIN_MAX) {
+			STAT(tc->stats.cached_bytes, -(unsigned long long)(bin->count - TCACHE_BIN_MAX / 2) * class_size(class));
+			tcache_flush(bin, TCACHE_BIN_MAX / 2);
+		}
+	}
+}
+
+/*
+   Aligned allocations. A block is only 16-byte aligned by itself, so for a
+   bigger alignment the block is taken with enough slack to find an aligned
+   payload inside it, and then the slack is cut off on both ends: the part in
+   front becomes a free block of its own (merging with a free neighbour if it
+   has one) and the part past the payload goes back through split_block(). So
+   the waste is at most a header's worth, not one alignment per block.
+   Anything that is past the mmap threshold (or would not fit in a chunk) gets
+   a mapping of its own, aligned the same way by map_block().
+ */
+// the smallest gap in front of an aligned payload that can be cut off as a block of its own
+#define MIN_LEAD (sizeof(header_t) + MIN_BLOCK_SIZE)
+
+// takes a block from the arena whose payload is aligned to `alignment` (a power of two above 16); caller holds the arena lock
+static header_t *acquire_aligned_block(struct arena *arena, size_t size, size_t alignment)
+{
+	header_t *header, *aligned;
+	size_t lead;
+
+	if (!(header = acquire_block(arena, size + alignment + MIN_LEAD)))
+		return NULL;
+	// already aligned, just trim the end
+	if (!((size_t)(header + 1) & (alignment - 1))) {
+		split_block(arena, header, size);
+		return header;
+	}
+	// the first aligned payload that leaves room for a block in front
+	aligned = (header_t*)(((size_t)(header + 1) + MIN_LEAD + alignment - 1) & ~(alignment - 1)) - 1;
+	lead = (char*)aligned - (char*)header;
+	aligned->s.size = header->s.size - lead;
+	aligned->s.is_free = 0;
+	aligned->s.is_mmapped = 0;
+	aligned->s.is_sampled = 0;
+	aligned->s.zero_from = header->s.zero_from > lead ? header->s.zero_from - lead : 0;
+	header->s.size = lead - sizeof(header_t);
+	if (header->s.zero_from > header->s.size)
+		header->s.zero_from = header->s.size;
+	// the lead block's boundary tag gets written into the aligned block's header
+	release_block(arena, header);
+	split_block(arena, aligned, size);
+	return aligned;
+}
+
+// the shared implementation of the aligned allocation functions, `alignment` has to be a power of two
+static void *allocate_aligned(size_t alignment, size_t size)
+{
+	header_t *header;
+	struct arena *arena;
+	struct tcache *tc;
+
+	// malloc() already aligns to 16 bytes
+	if (alignment <= SMALL_CLASS_STEP)
+		return allocate(size);
+	if (!size || size > ((size_t)-1 >> 2) || alignment > ((size_t)-1 >> 2))
+		return NULL;
+	size = ROUND_UP(size);
+	if (size + alignment + MIN_LEAD >= mmap_threshold || size + alignment + MIN_LEAD > CHUNK_MAX_BLOCK) {
+		header = map_block(size, alignment);
+	} else {
+		arena = get_arena();
+		arena_lock_own(arena);
+		header = acquire_aligned_block(arena, size, alignment);
+		arena_unlock(arena);
+	}
+	if (!header)
+		return NULL;
+	if ((tc = get_tcache()))
+		count_alloc(tc, header_class(header), header->s.size);
+	seal_header(header);
+	return (void*)(header + 1);
+}
+
+// POSIX: the alignment has to be a power of two and a multiple of sizeof(void *), returns 0 or an error number
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *block;
+
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1)))
+		return EINVAL;
+	block = traced(TRACE_MEMALIGN, allocate_aligned(alignment, size), size, alignment);
+	if (!block && size)
+		return ENOMEM;
+	*memptr = block;
+	return 0;
+}
+
+// C11: any power of two is a valid alignment
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (!alignment || (alignment & (alignment - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return traced(TRACE_MEMALIGN, allocate_aligned(alignment, size), size, alignment);
+}
+
+// the old interface, which (like glibc's) rounds an alignment that is not a power of two up to the next one
+void *memalign(size_t alignment, size_t size)
+{
+	if (alignment & (alignment - 1)) {
+		if (alignment > ((size_t)-1 >> 1))
+			return NULL;
+		alignment = (size_t)1 << (sizeof(unsigned long) * 8 - __builtin_clzl(alignment));
+	}
+	return traced(TRACE_MEMALIGN, allocate_aligned(alignment, size), size, alignment);
+}
+
+// page-aligned memory
+void *valloc(size_t size)
+{
+	return traced(TRACE_MEMALIGN, allocate_aligned(page_size(), size), size, page_size());
+}
+
+// page-aligned memory rounded up to whole pages
+void *pvalloc(size_t size)
+{
+	return traced(TRACE_MEMALIGN, allocate_aligned(page_size(), page_round(size ? size : 1)), page_round(size ? size : 1), page_size());
+}
+
+// how many bytes the block actually has room for, which can be more than what was asked for
+size_t malloc_usable_size(void *block)
+{
+	if (!block)
+		return 0;
+	if (is_slab(block))
+		return run_of(block)->size;
+	return ((header_t*)block - 1)->s.size;
+}
 
-// the free implementation that takes a void ptr (returned by other functions) to the memory block
-void free(void *block)
+/*
+   Sized frees. C23's free_sized() and free_aligned_sized() (and C++'s sized
+   delete) pass in the size the block was asked for, which is all free() would
+   have read the run of a small object for: with it, the object goes straight
+   onto the thread cache stack of its class, computed from the size and the
+   run's address alone, so nothing outside the object itself gets touched.
+   Everything else still needs its header (to know if it has its own mapping,
+   how big it really is, ...), so it takes the normal free() path, which reads
+   the header right in front of the block anyway.
+   Built with -DMEMALLOC_DEBUG, every sized free checks the size first and
+   aborts if the block could not have been allocated with it.
+ */
+#ifdef MEMALLOC_DEBUG
+// the size has to map to the class of a small object, or fit into a headered block
+// (which can be a few times bigger than what was asked for, having been cached in a class below its size)
+static void check_size(void *block, size_t size)
 {
-	header_t *header, *tmp;
-	// program break is ptr to the end of the process's data segment 
-	void *programbreak;
-	
-	// edge case: if block is null then just return
 	if (!block)
 		return;
-	pthread_mutex_lock(&global_malloc_lock);			// lock since we will be performing operations on linked list
-	header = (header_t*)block - 1;						// get the header of the block (by casting block to header_t, then subtracting it by 1 which moves ptr back by size of header_t, effectively pointing to header)
-	/* sbrk(0) gives the current program break address */
-	programbreak = sbrk(0);								
+	if (is_slab(block) ? size_class(size) != run_of(block)->class : size > malloc_usable_size(block))
+		fatal("free_sized(): size does not match the block");
+}
+#else
+#define check_size(block, size) ((void)0)
+#endif
 
-	/*
-	   Check if the block to be freed is the last one in the
-	   linked list. If it is, then we could shrink the size of the
-	   heap and release memory to OS. Else, we will keep the block
-	   but mark it as free.
-	 */
-	// cast to char for proper pointer arithmetic (header size is in bytes, so we need to add the memory block in bytes (1 char = 1 byte))
-	// if the block's ending address in linked list is the current program break address, it means it is the last block in list so we can free it from OS
-	if ((char*)block + header->s.size == programbreak) {
-		// only 1 block in linked list
-		if (head == tail) {
-			head = tail = NULL;
-		} else {
-			// if not only block, find the tail and free it from the list
-			tmp = head;
-			while (tmp) {
-				if(tmp->s.next == tail) {
-					tmp->s.next = NULL;
-					tail = tmp;
-				}
-				tmp = tmp->s.next;
-			}
+void free_sized(void *block, size_t size)
+{
+	struct tcache *tc;
+	struct tcache_bin *bin;
+	struct run *run;
+	unsigned class;
+
+	check_size(block, size);
+	trace_free(block);
+	if (block && is_slab(block) && size && (class = size_class(size)) < NUM_SMALL_CLASSES && class < tcache_classes && (tc = get_tcache())) {
+		check_slab(block);
+		run = run_of(block);
+		count_free(tc, class, class_size(class));
+		STAT(tc->stats.cached_bytes, class_size(class));
+		bin = &tc->bins[class];
+		((struct slab_free*)block)->mark = slab_mark(run);
+		set_link(block, bin->head);
+		bin->head = block;
+		if (++bin->count > TCACHE_BIN_MAX) {
+			STAT(tc->stats.cached_bytes, -(unsigned long long)(TCACHE_BIN_MAX + 1 - TCACHE_BIN_MAX / 2) * class_size(class));
+			tcache_flush(bin, TCACHE_BIN_MAX / 2);
 		}
-		/*
-		   sbrk() with a negative argument decrements the program break.
-		   So memory is released by the program to OS.
-		*/
-		// removes memory allocated for block 
-		sbrk(0 - header->s.size - sizeof(header_t));
-		/* Note: This lock does not really assure thread
-		   safety, because sbrk() itself is not really
-		   thread safe. Suppose there occurs a foreign sbrk(N)
-		   after we find the program break and before we decrement
-		   it, then we end up realeasing the memory obtained by
-		   the foreign sbrk().
-		*/
-		pthread_mutex_unlock(&global_malloc_lock);		// unlock right before returning
-		return;
-	}
-	// after that or if block not at end of linked list, set marker so that block is free
-	header->s.is_free = 1;
-	pthread_mutex_unlock(&global_malloc_lock);			// unlock right before function ends
+		return;
+	}
+	release(block);
 }
 
-// given size, returns void ptr to same size allocated memory in heap
-void *malloc(size_t size)
+// an alignment above 16 bytes always gets a headered block, so only the smaller ones can take the fast path
+void free_aligned_sized(void *block, size_t alignment, size_t size)
+{
+	if (alignment <= SMALL_CLASS_STEP) {
+		free_sized(block, size);
+		return;
+	}
+	check_size(block, size);
+	free(block);
+}
+
+/*
+   C++. operator new and delete are more names for the functions above, spelled
+   the way the Itanium C++ ABI mangles them so this file can stay plain C. new
+   may not return NULL: it calls the program's new_handler for as long as there
+   is one (which frees up memory, or throws itself), and then has libstdc++
+   throw std::bad_alloc, since C cannot throw (the unwinder gets through these
+   frames fine). The nothrow versions return NULL instead of calling the handler.
+ */
+// std::get_new_handler() and std::__throw_bad_alloc(), only there if the program uses libstdc++
+extern void (*_ZSt15get_new_handlerv(void))(void) __attribute__((weak));
+extern void _ZSt17__throw_bad_allocv(void) __attribute__((weak, noreturn));
+
+static void *cxx_new(size_t size, size_t alignment, int nothrow)
 {
-	// size of both header and requested size (given in function parameter)
-	size_t total_size;
-	// raw memory pointed to by sbrk()
+	void (*handler)(void);
 	void *block;
-	// useful to also bookkeep info about each blocks header (is memblock free or not, etc.)
-	header_t *header;
-	// edge case: check if size = 0, if so, return null ptr
+
+	// every new expression has to return a distinct pointer, even for 0 bytes
 	if (!size)
+		size = 1;
+	for (;;) {
+		if ((block = alignment ? allocate_aligned(alignment, size) : allocate(size)))
+			return traced(alignment ? TRACE_MEMALIGN : TRACE_MALLOC, block, size, alignment);
+		if (nothrow || !_ZSt15get_new_handlerv || !(handler = _ZSt15get_new_handlerv()))
+			break;
+		handler();
+	}
+	if (nothrow)
 		return NULL;
-	// only one thread can access allocator when operating on critical code like manipulating list, so we lock it
-	pthread_mutex_lock(&global_malloc_lock);
-	// searches linked list for existing free memblock that can hold requested size
-	header = get_free_block(size);
-	// remember that if header = NULL, we could not find a suitable block
-	if (header) {
-		/* Woah, found a free block to accomodate requested memory. */
-		header->s.is_free = 0;
-		pthread_mutex_unlock(&global_malloc_lock);		// unlock after traversal
-		// return the memory block portion and not the header to the user (done by header + 1)
-		// also cast to void ptr since that is what malloc returns (can be casted further by the user)
-		return (void*)(header + 1);
-	}
-	// Otherwise, we need to get memory to fit in the requested block and header from OS using sbrk() 
-	// basically add a new block to end of list if any previous blocks are not suitable using sbrk(total size)
-	total_size = sizeof(header_t) + size;
-	block = sbrk(total_size);
-	// if memory allocation fails, unlock and return null ptr
-	if (block == (void*) -1) {
-		pthread_mutex_unlock(&global_malloc_lock);		// unlock before returning NULL ptr
-		return NULL;
-	}
-	// if successfull, set up the header
-	header = block;						// basically sets start of newly allocated memory as a header_t (union header) structure (so it has a header and memblock) 
-	header->s.size = size;				// set size of memblock
-	header->s.is_free = 0;				// set it to not free
-	header->s.next = NULL;				// the next pointer points to nothing since it is the tail of linked list
-	// if linked list has no entries yet, the block is head
-	if (!head)
-		head = header;
-	// for updating tail ptr
-	if (tail)
-		tail->s.next = header;
-	// otherwise tail is header if only block in linked list
-	tail = header;
-	pthread_mutex_unlock(&global_malloc_lock);		// unlock after the head/tail manipulation
-	// get memblock location, then cast it to void ptr and return it
-	return (void*)(header + 1);
+	if (_ZSt17__throw_bad_allocv)
+		_ZSt17__throw_bad_allocv();
+	fatal("operator new: out of memory");
+	return NULL;
 }
 
-// given # of elements and type size, does the job of malloc() except sets/initializes memory to 0
-void *calloc(size_t num, size_t nsize)
+// operator new(size_t), new[](size_t), and their nothrow_t and align_val_t versions
+void *_Znwm(size_t size)
 {
-	// total size for memblock
-	size_t size;
-	// raw memory ptr
-	void *block;
-	// edge case: if either parameters given are 0 then return NULL
-	if (!num || !nsize)
-		return NULL;
-	// calculating total size for memblock
-	size = num * nsize;
-	/* check mul overflow */
-	if (nsize != size / num)
-		return NULL;
-	// do the job of malloc() first
-	block = malloc(size);
-	// if malloc() fails, return NULL ptr
-	if (!block)
-		return NULL;
-	// then if malloc() does its job, fill the block of memory with 0's using memset()
-	memset(block, 0, size);
-	// return the pointer to that memory block
-	// we do not have to mess with header of memblock, malloc() does it for us
-	return block;
+	return cxx_new(size, 0, 0);
 }
 
-// for resizing memory allocations 
-void *realloc(void *block, size_t size)
+void *_Znam(size_t size)
 {
-	// for pointing to the header of a memblock
-	header_t *header;
-	// readjusted raw memory ptr 
-	void *ret;
-	// edge case: if either block is NULL or size is 0, defer to malloc() (would return NULL ptr ideally)
-	if (!block || !size)
-		return malloc(size);
-	// to get header portion of block (casts it so that it points to header_t type, then moves ptr back by the size of header_t to get header location)
-	header = (header_t*)block - 1;
-	// if current block is already large enough to fit requested size, then return same block ptr without any changes
-	if (header->s.size >= size)
-		return block;
-	// if block not large enough, we will malloc() another block with requested size
-	ret = malloc(size);
-	// if mallocated memory for new, bigger block successfull
-	if (ret) {
-		// Relocate contents from the old block to the new bigger block using memcpy() 
-		memcpy(ret, block, header->s.size);
-		// Then free the old memory block 
-		free(block);
+	return cxx_new(size, 0, 0);
+}
+
+void *_ZnwmRKSt9nothrow_t(size_t size, const void *nt)
+{
+	(void)nt;
+	return cxx_new(size, 0, 1);
+}
+
+void *_ZnamRKSt9nothrow_t(size_t size, const void *nt)
+{
+	(void)nt;
+	return cxx_new(size, 0, 1);
+}
+
+void *_ZnwmSt11align_val_t(size_t size, size_t alignment)
+{
+	return cxx_new(size, alignment, 0);
+}
+
+void *_ZnamSt11align_val_t(size_t size, size_t alignment)
+{
+	return cxx_new(size, alignment, 0);
+}
+
+void *_ZnwmSt11align_val_tRKSt9nothrow_t(size_t size, size_t alignment, const void *nt)
+{
+	(void)nt;
+	return cxx_new(size, alignment, 1);
+}
+
+void *_ZnamSt11align_val_tRKSt9nothrow_t(size_t size, size_t alignment, const void *nt)
+{
+	(void)nt;
+	return cxx_new(size, alignment, 1);
+}
+
+// operator delete(void *), delete[](void *), their sized, nothrow_t and align_val_t versions
+// (new turned 0 bytes into 1, so a sized delete of 0 bytes has to go the unsized way)
+void _ZdlPv(void *block)
+{
+	free(block);
+}
+
+void _ZdaPv(void *block)
+{
+	free(block);
+}
+
+void _ZdlPvm(void *block, size_t size)
+{
+	free_sized(block, size ? size : 1);
+}
+
+void _ZdaPvm(void *block, size_t size)
+{
+	free_sized(block, size ? size : 1);
+}
+
+void _ZdlPvRKSt9nothrow_t(void *block, const void *nt)
+{
+	(void)nt;
+	free(block);
+}
+
+void _ZdaPvRKSt9nothrow_t(void *block, const void *nt)
+{
+	(void)nt;
+	free(block);
+}
+
+void _ZdlPvSt11align_val_t(void *block, size_t alignment)
+{
+	(void)alignment;
+	free(block);
+}
+
+void _ZdaPvSt11align_val_t(void *block, size_t alignment)
+{
+	(void)alignment;
+	free(block);
+}
+
+void _ZdlPvmSt11align_val_t(void *block, size_t size, size_t alignment)
+{
+	free_aligned_sized(block, alignment, size ? size : 1);
+}
+
+void _ZdaPvmSt11align_val_t(void *block, size_t size, size_t alignment)
+{
+	free_aligned_sized(block, alignment, size ? size : 1);
+}
+
+void _ZdlPvSt11align_val_tRKSt9nothrow_t(void *block, size_t alignment, const void *nt)
+{
+	(void)alignment;
+	(void)nt;
+	free(block);
+}
+
+void _ZdaPvSt11align_val_tRKSt9nothrow_t(void *block, size_t alignment, const void *nt)
+{
+	(void)alignment;
+	(void)nt;
+	free(block);
+}
+
+/*
+   Configuration. MEMALLOC_CONF is read once, right before the first allocation,
+   as a comma separated list of name:value pairs, e.g.
+   MEMALLOC_CONF=arenas:8,tcache_max:32k,mmap_threshold:256k,purge_decay:5000
+   - arenas:N			number of arenas (default: one per CPU, at most MAX_ARENAS)
+   - tcache_max:SIZE	largest size class kept in the thread caches, 0 turns them off
+   - mmap_threshold:SIZE	same as mallopt(M_MMAP_THRESHOLD, SIZE), wins over tcache_max (no cached class reaches it)
+   - purge_decay:MS		how long free pages stay before they are purged, -1 never purges
+   - purge:free		purge with MADV_FREE instead of MADV_DONTNEED
+   - thp:always|never	back the heap with transparent huge pages (or not), instead of leaving it to the system setting
+   - guard:0|1			put a guard page right past every block with its own mapping
+   - stats:0|1			whether the threads count their allocations
+   - stats_signal:N	dump malloc_stats() to stderr whenever signal N arrives (not SIGKILL, SIGSTOP or prof_signal)
+   - prof_sample:SIZE	sample about one allocation per SIZE bytes for heap profiles, 0 (default) is off
+   - prof_signal:N		dump a heap profile whenever signal N arrives (not SIGKILL, SIGSTOP or stats_signal)
+   - prof_prefix:PATH	where those go, as PATH.<pid>.<n>.heap (default: memalloc)
+   - trace:PATH		record every allocation and free in PATH.<pid>.trace (see Tracing)
+   Sizes take a k, m or g suffix. This all runs inside the allocator before it
+   is set up, so the parser only uses getenv() and plain loops (nothing that
+   could call malloc()), and reports bad pairs with write().
+ */
+static int stats_signal;
+static int prof_signal;
+static char prof_prefix[256] = "memalloc";
+
+// writes a message about the configuration to stderr
+static void conf_error(const char *what, const char *pair, size_t len)
+{
+	static const char prefix[] = "MEMALLOC_CONF: ";
+
+	if (write(STDERR_FILENO, prefix, sizeof(prefix) - 1) < 0 || write(STDERR_FILENO, what, strlen(what)) < 0 ||
+		write(STDERR_FILENO, pair, len) < 0 || write(STDERR_FILENO, "\n", 1) < 0)
+		return;
+}
+
+// parses a (possibly negative) number with an optional k/m/g suffix that makes up all of [str, end), returns 0 if it is not one
+static int conf_number(const char *str, const char *end, long long *out)
+{
+	long long n = 0;
+	int negative = 0;
+
+	if (str < end && *str == '-') {
+		negative = 1;
+		str++;
 	}
-	// return resized ptr to memblock
+	if (str == end || *str < '0' || *str > '9')
+		return 0;
+	for (; str < end && *str >= '0' && *str <= '9'; str++) {
+		if (n > ((long long)1 << 53))
+			return 0;
+		n = n * 10 + (*str - '0');
+	}
+	if (str < end) {
+		switch (*str++) {
+		case 'k': case 'K': n <<= 10; break;
+		case 'm': case 'M': n <<= 20; break;
+		case 'g': case 'G': n <<= 30; break;
+		default: return 0;
+		}
+	}
+	if (str != end)
+		return 0;
+	*out = negative ? -n : n;
+	return 1;
+}
+
+// whether a handler can be installed for signal n (SIGKILL and SIGSTOP can't be caught)
+static int conf_signal(long long n)
+{
+	return n >= 1 && n < NSIG && n != SIGKILL && n != SIGSTOP;
+}
+
+// applies one name:value pair, returns 0 if it is not valid
+static int conf_pair(const char *name, size_t name_len, const char *value, const char *end)
+{
+	long long n;
+
+	if (name_len == 5 && !strncmp(name, "purge", 5)) {
+		if (end - value == 4 && !strncmp(value, "free", 4))
+			purge_advice = MADV_FREE;
+		else if (end - value == 8 && !strncmp(value, "dontneed", 8))
+			purge_advice = MADV_DONTNEED;
+		else
+			return 0;
+		return 1;
+	}
+	if (name_len == 3 && !strncmp(name, "thp", 3)) {
+		if (end - value == 6 && !strncmp(value, "always", 6))
+			thp_mode = THP_ALWAYS;
+		else if (end - value == 5 && !strncmp(value, "never", 5))
+			thp_mode = THP_NEVER;
+		else if (end - value == 7 && !strncmp(value, "default", 7))
+			thp_mode = THP_DEFAULT;
+		else
+			return 0;
+		return 1;
+	}
+	if (name_len == 5 && !strncmp(name, "trace", 5)) {
+		if (end == value || (size_t)(end - value) >= sizeof(trace_prefix))
+			return 0;
+		memcpy(trace_prefix, value, end - value);
+		trace_prefix[end - value] = '\0';
+		return 1;
+	}
+	if (name_len == 11 && !strncmp(name, "prof_prefix", 11)) {
+		if (end == value || (size_t)(end - value) >= sizeof(prof_prefix))
+			return 0;
+		memcpy(prof_prefix, value, end - value);
+		prof_prefix[end - value] = '\0';
+		return 1;
+	}
+	if (!conf_number(value, end, &n))
+		return 0;
+	if (name_len == 6 && !strncmp(name, "arenas", 6)) {
+		if (n < 1 || n > MAX_ARENAS)
+			return 0;
+		conf_arenas = n;
+	} else if (name_len == 10 && !strncmp(name, "tcache_max", 10)) {
+		if (n < 0 || n > ((long long)1 << MEDIUM_CLASS_MAX_SHIFT))
+			return 0;
+		tcache_max_classes = n ? size_class(n) + 1 : 0;
+	} else if (name_len == 14 && !strncmp(name, "mmap_threshold", 14)) {
+		if (n < 0 || (size_t)n > CHUNK_MAX_BLOCK)
+			return 0;
+		mmap_threshold = n;
+	} else if (name_len == 11 && !strncmp(name, "purge_decay", 11)) {
+		purge_decay_ms = n < 0 ? -1 : n;
+	} else if (name_len == 5 && !strncmp(name, "guard", 5)) {
+		if (n != 0 && n != 1)
+			return 0;
+		guard_pages = n;
+	} else if (name_len == 5 && !strncmp(name, "stats", 5)) {
+		if (n != 0 && n != 1)
+			return 0;
+		stats_enabled = n;
+	} else if (name_len == 12 && !strncmp(name, "stats_signal", 12)) {
+		if (!conf_signal(n) || n == prof_signal)
+			return 0;
+		stats_signal = n;
+	} else if (name_len == 11 && !strncmp(name, "prof_sample", 11)) {
+		if (n < 0)
+			return 0;
+		prof_sample_bytes = n;
+	} else if (name_len == 11 && !strncmp(name, "prof_signal", 11)) {
+		if (!conf_signal(n) || n == stats_signal)
+			return 0;
+		prof_signal = n;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+// reads MEMALLOC_CONF, skipping (and complaining about) anything it does not understand
+static void read_conf(void)
+{
+	const char *conf = getenv("MEMALLOC_CONF"), *pair, *colon, *end;
+
+	if (!conf)
+		return;
+	for (pair = conf; *pair; pair = *end ? end + 1 : end) {
+		for (end = pair; *end && *end != ','; end++)
+			;
+		if (end == pair)
+			continue;
+		for (colon = pair; colon < end && *colon != ':'; colon++)
+			;
+		if (colon == end || !conf_pair(pair, colon - pair, colon + 1, end))
+			conf_error("ignoring invalid option ", pair, end - pair);
+	}
+}
+
+/*
+   Reporting. Everything below writes with write() into a buffer on the stack
+   instead of going through printf(), which could call back into malloc(), and
+   only ever try-locks when it runs in a signal handler: the interrupted thread
+   may be holding the very lock it would wait for. An arena (or the thread
+   registry) that happens to be busy at that moment is simply left out.
+ */
+struct report {
+	int fd;
+	size_t len;
+	char buf[512];
+};
+
+static void report_flush(struct report *r)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < r->len && (n = write(r->fd, r->buf + done, r->len - done)) > 0)
+		done += n;
+	r->len = 0;
+}
+
+static void report_str(struct report *r, const char *str)
+{
+	for (; *str; str++) {
+		if (r->len == sizeof(r->buf))
+			report_flush(r);
+		r->buf[r->len++] = *str;
+	}
+}
+
+static void report_num(struct report *r, unsigned long long n)
+{
+	char digits[24];
+	int i = sizeof(digits) - 1;
+
+	digits[i] = '\0';
+	do {
+		digits[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	report_str(r, digits + i);
+}
+
+// a "label = number" line
+static void report_line(struct report *r, const char *label, unsigned long long n)
+{
+	report_str(r, label);
+	report_str(r, " = ");
+	report_num(r, n);
+	report_str(r, "\n");
+}
+
+static int stats_trylock(pthread_mutex_t *lock, int from_signal)
+{
+	return from_signal ? pthread_mutex_trylock(lock) == 0 : pthread_mutex_lock(lock) == 0;
+}
+
+// adds up the counters of every thread, live or exited
+static void sum_stats(struct thread_stats *total, int from_signal)
+{
+	struct tcache *tc;
+
+	memset(total, 0, sizeof(*total));
+	if (!stats_trylock(&stats_lock, from_signal))
+		return;
+	add_stats(total, &retired_stats);
+	for (tc = registry; tc; tc = tc->next)
+		add_stats(total, &tc->stats);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+// a snapshot of one arena's statistics, taken under its lock
+struct arena_stats {
+	size_t num_chunks;
+	size_t slab_bytes;
+	size_t num_runs;
+	size_t num_empty_runs;
+	size_t num_released_runs;
+	size_t free_bytes;
+	size_t spare_bytes;
+	size_t free_blocks;
+	size_t free_count[NUM_CLASSES];
+	unsigned long long lock_count;
+	unsigned long long lock_contended;
+	unsigned long long remote_collected;
+	unsigned long long purged_bytes;
+};
+
+// returns 0 if the arena was busy (only possible from a signal handler)
+static int read_arena(struct arena *arena, struct arena_stats *out, int from_signal)
+{
+	unsigned class;
+
+	if (!stats_trylock(&arena->lock, from_signal))
+		return 0;
+	out->num_chunks = arena->num_chunks;
+	out->slab_bytes = arena->slab_bytes;
+	out->num_runs = arena->num_runs;
+	out->num_empty_runs = arena->num_empty_runs;
+	out->num_released_runs = arena->num_released_runs;
+	out->free_bytes = arena->free_bytes;
+	out->spare_bytes = arena->spare_chunk ? CHUNK_MAX_BLOCK : 0;
+	out->free_blocks = 0;
+	for (class = 0; class < NUM_CLASSES; class++) {
+		out->free_count[class] = arena->free_count[class];
+		out->free_blocks += arena->free_count[class];
+	}
+	out->lock_count = arena->lock_count;
+	out->lock_contended = arena->lock_contended;
+	out->remote_collected = arena->remote_collected;
+	out->purged_bytes = arena->purged_bytes;
+	pthread_mutex_unlock(&arena->lock);
+	return 1;
+}
+
+// glibc's mallinfo2(): the arena fields cover the chunks, hblks/hblkhd the blocks with their own mapping,
+// and fsmblks (fastbins in glibc) the bytes sitting in thread caches
+struct mallinfo2 mallinfo2(void)
+{
+	struct mallinfo2 info;
+	struct thread_stats total;
+	struct arena_stats a;
+	unsigned i;
+
+	memset(&info, 0, sizeof(info));
+	for (i = 0; i < num_arenas; i++) {
+		if (!read_arena(&arenas[i], &a, 0))
+			continue;
+		info.arena += a.num_chunks * CHUNK_SIZE + a.slab_bytes;
+		info.ordblks += a.free_blocks;
+		info.fordblks += a.free_bytes;
+		info.keepcost += a.spare_bytes;
+	}
+	info.hblks = atomic_load(&mapped_blocks);
+	info.hblkhd = atomic_load(&mapped_block_bytes);
+	sum_stats(&total, 0);
+	info.fsmblks = READ(total.cached_bytes);
+	// without thread stats all that is known is what the arenas do not have free
+	if (stats_enabled)
+		info.uordblks = READ(total.bytes_allocated) - READ(total.bytes_freed) - info.hblkhd;
+	else
+		info.uordblks = info.arena - info.fordblks;
+	return info;
+}
+
+// the old int-sized mallinfo(), which wraps around past 2 GB just like glibc's
+struct mallinfo mallinfo(void)
+{
+	struct mallinfo2 info2 = mallinfo2();
+	struct mallinfo info;
+
+	info.arena = info2.arena;
+	info.ordblks = info2.ordblks;
+	info.smblks = info2.smblks;
+	info.hblks = info2.hblks;
+	info.hblkhd = info2.hblkhd;
+	info.usmblks = info2.usmblks;
+	info.fsmblks = info2.fsmblks;
+	info.uordblks = info2.uordblks;
+	info.fordblks = info2.fordblks;
+	info.keepcost = info2.keepcost;
+	return info;
+}
+
+// writes the full report: per arena, totals, thread caches and per size class
+static void write_stats(int fd, int from_signal)
+{
+	struct report r;
+	struct thread_stats total;
+	struct arena_stats a;
+	size_t free_count[NUM_CLASSES];
+	unsigned long long in_use, lookups;
+	unsigned i, class;
+
+	r.fd = fd;
+	r.len = 0;
+	memset(free_count, 0, sizeof(free_count));
+	for (i = 0; i < num_arenas; i++) {
+		report_str(&r, "Arena ");
+		report_num(&r, i);
+		if (!read_arena(&arenas[i], &a, from_signal)) {
+			report_str(&r, ": (busy)\n");
+			continue;
+		}
+		report_str(&r, ":\n");
+		report_line(&r, "system bytes     ", a.num_chunks * CHUNK_SIZE + a.slab_bytes);
+		report_line(&r, "slab bytes       ", a.slab_bytes);
+		report_line(&r, "runs             ", a.num_runs);
+		report_line(&r, "empty runs       ", a.num_empty_runs);
+		report_line(&r, "released runs    ", a.num_released_runs);
+		report_line(&r, "free bytes       ", a.free_bytes);
+		report_line(&r, "free blocks      ", a.free_blocks);
+		report_line(&r, "lock acquisitions", a.lock_count);
+		report_line(&r, "lock contended   ", a.lock_contended);
+		report_line(&r, "remote frees     ", a.remote_collected);
+		report_line(&r, "purged bytes     ", a.purged_bytes);
+		for (class = 0; class < NUM_CLASSES; class++)
+			free_count[class] += a.free_count[class];
+	}
+	sum_stats(&total, from_signal);
+	in_use = READ(total.bytes_allocated) - READ(total.bytes_freed);
+	report_str(&r, "Total (incl. mmap):\n");
+	report_line(&r, "system bytes     ", atomic_load(&mapped_bytes));
+	if (stats_enabled)
+		report_line(&r, "in use bytes     ", in_use);
+	report_line(&r, "mmap regions     ", atomic_load(&mapped_blocks));
+	report_line(&r, "mmap bytes       ", atomic_load(&mapped_block_bytes));
+	if (!stats_enabled) {
+		report_str(&r, "(thread stats are off)\n");
+		report_flush(&r);
+		return;
+	}
+	report_str(&r, "Thread caches:\n");
+	report_line(&r, "cached bytes     ", READ(total.cached_bytes));
+	report_line(&r, "hits             ", READ(total.cache_hits));
+	report_line(&r, "misses           ", READ(total.cache_misses));
+	lookups = READ(total.cache_hits) + READ(total.cache_misses);
+	report_line(&r, "hit rate (%)     ", lookups ? READ(total.cache_hits) * 100 / lookups : 0);
+	report_str(&r, "Size classes (size: allocs frees free-blocks):\n");
+	for (class = 0; class <= NUM_CLASSES; class++) {
+		if (!READ(total.allocs[class]) && !READ(total.frees[class]) && (class == NUM_CLASSES || !free_count[class]))
+			continue;
+		if (class == MAPPED_CLASS)
+			report_str(&r, "mmap");
+		else if (class == LARGE_CLASS)
+			report_str(&r, "large");
+		else
+			report_num(&r, class_size(class));
+		report_str(&r, ": ");
+		report_num(&r, READ(total.allocs[class]));
+		report_str(&r, " ");
+		report_num(&r, READ(total.frees[class]));
+		report_str(&r, " ");
+		report_num(&r, class == MAPPED_CLASS ? 0 : free_count[class]);
+		report_str(&r, "\n");
+	}
+	report_flush(&r);
+}
+
+// glibc's malloc_stats(): prints the report to stderr
+void malloc_stats(void)
+{
+	write_stats(STDERR_FILENO, 0);
+}
+
+static void stats_signal_handler(int sig)
+{
+	int saved = errno;
+
+	(void)sig;
+	write_stats(STDERR_FILENO, 1);
+	errno = saved;
+}
+
+// installs the stats dump on the signal from stats_signal in MEMALLOC_CONF, if set
+static void install_stats_signal(void)
+{
+	struct sigaction sa;
+
+	if (!stats_signal)
+		return;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stats_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(stats_signal, &sa, NULL);
+}
+
+/*
+   Heap profiles. memalloc_prof_dump() writes the live samples, per stack, in
+   the text format of gperftools' heap profiler: a "heap profile:" line with
+   the totals and the sampling rate, one "live: bytes [allocated: bytes] @
+   addresses" line per stack, then /proc/self/maps so pprof can symbolize the
+   addresses. The counts are the raw samples, pprof scales them by the rate.
+ */
+static void report_hex(struct report *r, size_t n)
+{
+	char digits[24];
+	int i = sizeof(digits) - 1;
+
+	digits[i] = '\0';
+	do {
+		digits[--i] = "0123456789abcdef"[n & 15];
+		n >>= 4;
+	} while (n);
+	digits[--i] = 'x';
+	digits[--i] = '0';
+	report_str(r, digits + i);
+}
+
+// a "live: bytes [allocated: bytes]" count
+static void report_counts(struct report *r, size_t live_count, size_t live_bytes, size_t alloc_count, size_t alloc_bytes)
+{
+	report_num(r, live_count);
+	report_str(r, ": ");
+	report_num(r, live_bytes);
+	report_str(r, " [");
+	report_num(r, alloc_count);
+	report_str(r, ": ");
+	report_num(r, alloc_bytes);
+	report_str(r, "]");
+}
+
+static int write_profile(int fd, int from_signal)
+{
+	struct report r = { .fd = fd };
+	struct prof_stack *stack, total = { 0 };
+	char buf[512];
+	ssize_t n;
+	unsigned i;
+	int maps;
+
+	if (!stats_trylock(&prof_lock, from_signal))
+		return -1;
+	for (stack = prof_stacks; stack < prof_stacks + PROF_STACKS; stack++) {
+		total.live_count += stack->live_count;
+		total.live_bytes += stack->live_bytes;
+		total.alloc_count += stack->alloc_count;
+		total.alloc_bytes += stack->alloc_bytes;
+	}
+	report_str(&r, "heap profile: ");
+	report_counts(&r, total.live_count, total.live_bytes, total.alloc_count, total.alloc_bytes);
+	report_str(&r, " @ heap_v2/");
+	report_num(&r, prof_sample_bytes);
+	report_str(&r, "\n");
+	for (stack = prof_stacks; stack < prof_stacks + PROF_STACKS; stack++) {
+		if (!stack->hash)
+			continue;
+		report_counts(&r, stack->live_count, stack->live_bytes, stack->alloc_count, stack->alloc_bytes);
+		report_str(&r, " @");
+		for (i = 0; i < stack->depth; i++) {
+			report_str(&r, " ");
+			report_hex(&r, (size_t)stack->pcs[i]);
+		}
+		report_str(&r, "\n");
+	}
+	if (prof_dropped) {
+		report_str(&r, "# dropped samples: ");
+		report_num(&r, prof_dropped);
+		report_str(&r, "\n");
+	}
+	pthread_mutex_unlock(&prof_lock);
+	report_str(&r, "\nMAPPED_LIBRARIES:\n");
+	report_flush(&r);
+	if ((maps = open("/proc/self/maps", O_RDONLY)) >= 0) {
+		while ((n = read(maps, buf, sizeof(buf))) > 0 && write(fd, buf, n) == n)
+			;
+		close(maps);
+	}
+	return 0;
+}
+
+// writes a heap profile to path, or prof_prefix.<pid>.<n>.heap when it is NULL
+static int prof_dump(const char *path, int from_signal)
+{
+	static atomic_uint seq;
+	struct report name = { .fd = -1 };
+	int fd, ret;
+
+	if (!prof_sample_bytes)
+		return -1;
+	if (!path) {
+		report_str(&name, prof_prefix);
+		report_str(&name, ".");
+		report_num(&name, getpid());
+		report_str(&name, ".");
+		report_num(&name, atomic_fetch_add(&seq, 1));
+		report_str(&name, ".heap");
+		if (name.len == sizeof(name.buf))
+			return -1;
+		name.buf[name.len] = '\0';
+		path = name.buf;
+	}
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+		return -1;
+	ret = write_profile(fd, from_signal);
+	close(fd);
 	return ret;
 }
 
-// A debug function to print the entire link list
+// creates trace_prefix.<pid>.trace and writes its header (at start-up, and again in a forked child)
+static void trace_open(void)
+{
+	struct report name = { .fd = -1 };
+	struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record) };
+
+	report_str(&name, trace_prefix);
+	report_str(&name, ".");
+	report_num(&name, getpid());
+	report_str(&name, ".trace");
+	if (name.len == sizeof(name.buf))
+		return;
+	name.buf[name.len] = '\0';
+	if ((trace_fd = open(name.buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0)
+		trace_write(&header, sizeof(header));
+}
+
+// starts tracing if MEMALLOC_CONF asked for it
+static void trace_init(void)
+{
+	if (trace_prefix[0])
+		trace_open();
+}
+
+// writes a heap profile on demand (see prof_dump()), returns 0 on success and -1 if profiling is off or it fails
+int memalloc_prof_dump(const char *path)
+{
+	return prof_dump(path, 0);
+}
+
+static void prof_signal_handler(int sig)
+{
+	int saved = errno;
+
+	(void)sig;
+	prof_dump(NULL, 1);
+	errno = saved;
+}
+
+// installs the profile dump on the signal from prof_signal in MEMALLOC_CONF, if set (and profiling is on)
+static void install_prof_signal(void)
+{
+	struct sigaction sa;
+
+	if (!prof_signal || !prof_sample_bytes)
+		return;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = prof_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(prof_signal, &sa, NULL);
+}
+
+// A debug function to print every arena's chunks and the blocks laid out in them
 void print_mem_list()
 {	
-	// standard linked list traversal
-	header_t *curr = head;
+	struct arena *arena;
+	struct chunk *chunk;
+	struct run *run;
+	header_t *curr;
+	unsigned class;
+
 	// typecast ptrs to void to ensure they are printed as addresses with "%p"
 	// "%zu" = size_t values (size depends on platform), "%u" = unsigned int 
-	printf("head = %p, tail = %p \n", (void*)head, (void*)tail);
-	while(curr) {
-		printf("addr = %p, size = %zu, is_free=%u, next=%p\n",
-			(void*)curr, curr->s.size, curr->s.is_free, (void*)curr->s.next);
-		curr = curr->s.next;
+	// neighbouring free blocks are merged as soon as they are freed, so two free blocks never show up in a row
+	// (blocks with their own mapping and blocks sitting in a thread cache show up as in use, or not at all)
+	for (arena = arenas; arena < arenas + num_arenas; arena++) {
+		printf("arena %u\n", (unsigned)(arena - arenas));
+		// small objects live in runs, full runs are on no list so only the ones with room left show up
+		for (class = 0; class < NUM_SMALL_CLASSES; class++)
+			for (run = arena->partial_runs[class]; run; run = run->next)
+				printf("run = %p, size = %u, used = %u/%u\n", (void*)run, run->size, run->used, run->capacity);
+		for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+			printf("chunk = %p%s\n", (void*)chunk, chunk == arena->spare_chunk ? " (spare)" : "");
+			// walk the blocks back to back until the zero-sized fence
+			for (curr = chunk_first_block(chunk); curr->s.size; curr = next_block(curr))
+				printf("addr = %p, size = %zu, is_free=%u, prev_free=%u\n",
+					(void*)curr, curr->s.size, curr->s.is_free, curr->s.prev_free);
+		}
 	}
 }
@@ -0,0 +1,374 @@
+// replays an allocation trace (see trace:PATH in MEMALLOC_CONF) against the memory allocator (or any other malloc() preloaded in front of it)
+#define _GNU_SOURCE			// for MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>			// for open() on the trace and /proc/self files
+#include <getopt.h>			// for parsing the command line options
+#include <malloc.h>			// for memalign()
+#include <time.h>			// for clock_gettime() to time the replay
+#include <sys/mman.h>		// for mmap(), the replay's own bookkeeping stays out of the allocator under test
+#include <sys/stat.h>		// for fstat() to size the trace
+#include <sys/resource.h>	// for getrusage() to read the peak RSS where /proc/self/clear_refs is not there
+
+/*
+   How it works. The records of every thread are put back in the order the
+   calls were made (by their timestamps) and every pointer id (the address the
+   traced program got) is turned into a slot of its own, before anything is
+   timed. Then the calls are made again one after the other from one thread,
+   each allocation writing a byte into every page of its block the way the
+   program would have used it. So what the numbers say is how the allocator
+   under test lays out and reuses memory for that stream of requests and what
+   each call costs, not how it copes with the threads contending.
+   Reading the numbers: peak RSS is the most memory the process had resident
+   during the replay, minus what it had before it (the replay's own tables),
+   peak live is the most bytes the program had asked for and not freed yet,
+   and fragmentation is the one over the other (1.00 would be no overhead).
+   To compare with glibc run the same binary with and without
+   LD_PRELOAD=./mem_allocator.so.
+ */
+
+// has to match mem_allocator.c
+#define TRACE_MAGIC "MEMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_NO_THREAD ((1U << 20) - 1)
+
+enum { TRACE_MALLOC = 1, TRACE_CALLOC, TRACE_REALLOC, TRACE_FREE, TRACE_MEMALIGN };
+
+struct trace_header {
+	char magic[8];
+	unsigned version;
+	unsigned record_size;
+};
+
+struct trace_record {
+	unsigned long long time;
+	unsigned long long ptr;
+	unsigned long long arg;
+	unsigned long long size : 40;
+	unsigned long long thread : 20;
+	unsigned long long op : 4;
+};
+
+// slot of a call without a block (realloc(NULL, size))
+#define NO_SLOT ((unsigned)-1)
+#define PAGE 4096
+
+// one call to make again
+struct op {
+	int kind;							// TRACE_*
+	unsigned slot;						// the block it allocates or frees
+	unsigned old;						// realloc(): the block it is given
+	size_t size;
+	size_t align;						// memalign(): the alignment
+};
+
+// a block of the replay, by slot
+struct slot {
+	void *block;
+	size_t size;
+};
+
+// orders the records by time, and records taken at the same nanosecond by where they are in the file
+struct order {
+	unsigned long long time;
+	size_t index;
+};
+
+// pointer id -> slot, for the blocks live at that point of the trace
+struct entry {
+	unsigned long long ptr;				// 0 = empty
+	unsigned slot;
+};
+
+static struct entry *table;
+static size_t table_mask;
+
+// memory for the bookkeeping, straight from the OS so it does not disturb the allocator being measured
+static void *map_zeroed(size_t size)
+{
+	void *p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		perror("replay: mmap");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int by_time(const void *a, const void *b)
+{
+	const struct order *x = a, *y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static size_t table_home(unsigned long long ptr)
+{
+	return (ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & table_mask;
+}
+
+// returns the entry for ptr, or the empty one where it would go
+static struct entry *table_find(unsigned long long ptr)
+{
+	size_t i;
+
+	for (i = table_home(ptr); table[i].ptr && table[i].ptr != ptr; i = (i + 1) & table_mask)
+		;
+	return &table[i];
+}
+
+// takes an entry out, moving the ones after it back so that no lookup stops early
+static void table_remove(struct entry *entry)
+{
+	size_t i = entry - table, j, home;
+
+	for (j = (i + 1) & table_mask; table[j].ptr; j = (j + 1) & table_mask) {
+		home = table_home(table[j].ptr);
+		// the entry at j can move to i if i lies on its way from its home slot to j
+		if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].ptr = 0;
+}
+
+// reads a "Name:   N kB" line out of /proc/self/status, returns -1 if it is not there
+static long status_kb(const char *name)
+{
+	char buf[4096], *line;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open("/proc/self/status", O_RDONLY)) < 0)
+		return -1;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	for (line = buf; line; line = (line = strchr(line, '\n')) ? line + 1 : NULL)
+		if (!strncmp(line, name, strlen(name)) && line[strlen(name)] == ':')
+			return atol(line + strlen(name) + 1);
+	return -1;
+}
+
+// resets the peak RSS the kernel keeps (VmHWM) to what is resident now, returns 0 if it worked
+static int reset_peak_rss(void)
+{
+	int fd = open("/proc/self/clear_refs", O_WRONLY), ok;
+
+	if (fd < 0)
+		return -1;
+	ok = write(fd, "5", 1) == 1;
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+// writes into every page of a block, like the program that asked for it would have
+static void touch(char *block, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i += PAGE)
+		block[i] = 1;
+	if (size)
+		block[size - 1] = 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: replay [-u] file.trace\n");
+	fprintf(stderr, "  -u  don't write into the blocks (only the allocator's own writes count towards RSS)\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *preload = getenv("LD_PRELOAD");
+	const struct trace_header *header;
+	const struct trace_record *records, *r;
+	struct order *order;
+	struct op *ops, *op;
+	struct slot *slots;
+	struct entry *entry;
+	struct stat st;
+	struct rusage ru;
+	size_t count, num_ops = 0, skipped = 0, i, live = 0, peak_live = 0, end_live;
+	unsigned num_slots = 0, threads = 0;
+	unsigned long long start, elapsed;
+	long base_rss, peak_rss, end_rss;
+	int fd, opt, use = 1, have_hwm;
+	char *map;
+	void *block;
+
+	while ((opt = getopt(argc, argv, "uh")) != -1) {
+		switch (opt) {
+		case 'u':
+			use = 0;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	header = (const struct trace_header*)(map = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0));
+	close(fd);
+	if (map == MAP_FAILED || (size_t)st.st_size < sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, 8) ||
+		header->version != TRACE_VERSION || header->record_size != sizeof(struct trace_record)) {
+		fprintf(stderr, "replay: %s is not a trace this replay can read\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	records = (const struct trace_record*)(header + 1);
+	count = (st.st_size - sizeof(*header)) / sizeof(struct trace_record);
+
+	// back in the order the calls were made
+	order = map_zeroed(count * sizeof(struct order));
+	for (i = 0; i < count; i++) {
+		order[i].time = records[i].time;
+		order[i].index = i;
+		if (records[i].thread != TRACE_NO_THREAD && records[i].thread >= threads)
+			threads = records[i].thread + 1;
+	}
+	qsort(order, count, sizeof(struct order), by_time);
+
+	// pointer ids to slots: every allocation gets a new slot, a free looks up the slot of the block's address
+	// (an allocation may come up at an address still live in the trace when the block was freed inside a realloc()
+	// that moved it: the allocation stands for its free then; a free of a block from before the trace, e.g. one a
+	// forked child got from its parent, is left out)
+	ops = map_zeroed(2 * count * sizeof(struct op));
+	slots = map_zeroed(count * sizeof(struct slot));
+	for (table_mask = 1; table_mask < 2 * count; table_mask <<= 1)
+		;
+	table = map_zeroed(table_mask * sizeof(struct entry));
+	table_mask--;
+	for (i = 0; i < count; i++) {
+		r = &records[order[i].index];
+		op = &ops[num_ops];
+		op->kind = r->op;
+		op->old = NO_SLOT;
+		op->size = r->size;
+		op->align = r->arg;
+		switch (r->op) {
+		case TRACE_FREE:
+			if (!(entry = table_find(r->ptr))->ptr) {
+				skipped++;
+				continue;
+			}
+			op->slot = entry->slot;
+			table_remove(entry);
+			num_ops++;
+			continue;
+		case TRACE_REALLOC:
+			if (r->arg && (entry = table_find(r->arg))->ptr) {
+				op->old = entry->slot;
+				table_remove(entry);
+			}
+			break;
+		case TRACE_MALLOC:
+		case TRACE_CALLOC:
+		case TRACE_MEMALIGN:
+			break;
+		default:
+			skipped++;
+			continue;
+		}
+		if ((entry = table_find(r->ptr))->ptr) {
+			ops[num_ops + 1] = *op;
+			op->kind = TRACE_FREE;
+			op->slot = entry->slot;
+			op = &ops[++num_ops];
+		} else {
+			entry->ptr = r->ptr;
+		}
+		entry->slot = op->slot = num_slots++;
+		num_ops++;
+	}
+
+	// the trace and the tables that are done with go back, so the RSS the replay starts from is mostly its op list
+	munmap(map, st.st_size ? st.st_size : 1);
+	munmap(order, count * sizeof(struct order));
+	munmap(table, (table_mask + 1) * sizeof(struct entry));
+	memset(slots, 0, num_slots * sizeof(struct slot));
+	have_hwm = reset_peak_rss() == 0 && status_kb("VmHWM") >= 0;
+	base_rss = status_kb("VmRSS");
+
+	start = now_ns();
+	for (op = ops; op < ops + num_ops; op++) {
+		switch (op->kind) {
+		case TRACE_MALLOC:
+			block = malloc(op->size);
+			break;
+		case TRACE_CALLOC:
+			block = calloc(1, op->size);
+			break;
+		case TRACE_MEMALIGN:
+			block = memalign(op->align, op->size);
+			break;
+		case TRACE_REALLOC:
+			if (op->old != NO_SLOT) {
+				live -= slots[op->old].size;
+				block = realloc(slots[op->old].block, op->size);
+				slots[op->old].block = NULL;
+			} else {
+				block = realloc(NULL, op->size);
+			}
+			break;
+		default:
+			free(slots[op->slot].block);
+			live -= slots[op->slot].size;
+			slots[op->slot].block = NULL;
+			slots[op->slot].size = 0;
+			continue;
+		}
+		if (!block && op->size) {
+			fprintf(stderr, "replay: out of memory at op %zu (%zu bytes)\n", (size_t)(op - ops), op->size);
+			return EXIT_FAILURE;
+		}
+		if (use)
+			touch(block, op->size);
+		slots[op->slot].block = block;
+		slots[op->slot].size = op->size;
+		if ((live += op->size) > peak_live)
+			peak_live = live;
+	}
+	elapsed = now_ns() - start;
+
+	end_live = live;
+	end_rss = status_kb("VmRSS");
+	if (have_hwm) {
+		peak_rss = status_kb("VmHWM");
+	} else {
+		getrusage(RUSAGE_SELF, &ru);
+		peak_rss = ru.ru_maxrss;
+	}
+
+	printf("malloc: %s\n", preload && *preload ? preload : "glibc");
+	printf("trace: %s, %zu records from %u threads (%zu left out)\n", argv[optind], count, threads, skipped);
+	printf("ops: %zu in %.3f s, %.1f ns per op\n", num_ops, elapsed / 1e9, num_ops ? (double)elapsed / num_ops : 0.0);
+	printf("peak RSS: %ld KB (on top of the replay's own %ld KB)%s\n", peak_rss - base_rss, base_rss,
+		have_hwm ? "" : ", since start-up");
+	printf("peak live: %zu KB\n", peak_live / 1024);
+	if (peak_live)
+		printf("fragmentation: %.2f (peak RSS / peak live)\n", (peak_rss - base_rss) * 1024.0 / peak_live);
+	printf("at the end: %zu KB live, %ld KB resident\n", end_live / 1024, end_rss - base_rss);
+	return 0;
+}